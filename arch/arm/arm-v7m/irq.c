@@ -13,10 +13,12 @@
 #include <asm/hwio.h>
 #include <asm/irq.h>
 #include <phabos/kprintf.h>
+#include <config.h>
 
 #define SETENA0 0xE000E100
 #define CLRENA0 0xE000E180
 #define CLRPEND0 0xE000E280
+#define IPR0 0xE000E400
 
 #define ARM_CM_NUM_EXCEPTION 16
 
@@ -36,8 +38,18 @@ void default_irq_handler(int irq, void *data)
 
 void irq_initialize(void)
 {
-    for (int i = 0; i < CPU_NUM_IRQ; i++)
+    for (int i = 0; i < CPU_NUM_IRQ; i++) {
         irq_disable_line(i);
+        irq_set_priority(i, CONFIG_IRQ_KERNEL_PRIORITY);
+    }
+}
+
+void irq_set_priority(int line, uint8_t priority)
+{
+    assert(line < CPU_NUM_IRQ);
+    assert(line != 0xFF);
+
+    write8(IPR0 + line, priority);
 }
 
 void irq_disable_line(int line)
@@ -74,16 +86,26 @@ void irq_enable_line(int line)
     irq_enable();
 }
 
+/*
+ * Kernel critical sections only mask the interrupts up to the kernel priority
+ * ceiling, interrupts of a higher priority are still served without delay.
+ *
+ * The nesting counter is updated while BASEPRI is still unmasked on both
+ * sides, so that an interrupt above the ceiling can never leave BASEPRI
+ * cleared inside a critical section.
+ */
 void irq_disable(void)
 {
-    asm volatile("cpsid i");
     irq_global_state++;
+    asm volatile("msr basepri, %0\n\t"
+                 "isb"
+                 :: "r"(CONFIG_IRQ_KERNEL_PRIORITY) : "memory");
 }
 
 void irq_enable(void)
 {
     if (--irq_global_state == 0)
-        asm volatile("cpsie i");
+        asm volatile("msr basepri, %0" :: "r"(0) : "memory");
 }
 
 int irq_attach(int line, irq_handler_t handler, void *data)
@@ -15,6 +15,7 @@
 #include <phabos/kprintf.h>
 #include <phabos/panic.h>
 #include <phabos/scheduler.h>
+#include <phabos/trace.h>
 
 #include <string.h>
 #include <stdint.h>
@@ -161,7 +162,8 @@ static void dump_context(uint32_t *context)
             context[R0_REG], context[R1_REG], context[R2_REG], context[R3_REG],
             context[R4_REG], context[R5_REG], context[R6_REG], context[R7_REG],
             context[R8_REG], context[R9_REG], context[R10_REG],
-            context[R11_REG], context[R12_REG], context[SP_REG],
+            context[R11_REG], context[R12_REG],
+            (uint32_t) (context + MAX_REG),
             context[LR_REG], context[PC_REG], context[PSR_REG],
             context[BASEPRI_REG]);
 
@@ -199,7 +201,7 @@ uint32_t memfault_handler(uint32_t *context)
         panic(NULL);
     }
 
-    return context[SP_REG];
+    return (uint32_t) context;
 }
 
 static void irq_common_isr(void)
@@ -210,5 +212,7 @@ static void irq_common_isr(void)
     asm volatile("mrs %0, xpsr" : "=r"(psr));
     irq = psr & 0xFF;
 
+    trace_record(TRACE_IRQ_ENTER, irq);
     irq_vector[irq].handler(irq - ARM_CM_NUM_EXCEPTION, irq_vector[irq].data);
+    trace_record(TRACE_IRQ_EXIT, irq);
 }
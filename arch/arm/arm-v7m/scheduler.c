@@ -11,15 +11,32 @@
 
 #include <config.h>
 #include <phabos/scheduler.h>
+#include <phabos/watchdog.h>
 #include <asm/scheduler.h>
 #include <asm/hwio.h>
 #include <asm/machine.h>
 
 #define ICSR                            0xE000ED04
 #define ICSR_PENDSVSET                  (1 << 28)
+#define ICSR_PENDSTSET                  (1 << 26)
+#define ICSR_PENDSTCLR                  (1 << 25)
+
+#define STCSR                           0xE000E010
+#define STCSR_SYSTICK_ENABLE            (1 << 0)
+#define STCSR_TICKINT                   (1 << 1)
+#define STCSR_CLKSOURCE                 (1 << 2)
+#define STCSR_COUNTFLAG                 (1 << 16)
+#define STRVR                           0xE000E014
+#define STCVR                           0xE000E018
+
+#define SYSTICK_PERIOD                  (CPU_FREQ / HZ)
+#define SYSTICK_MAX_RELOAD              0x00FFFFFF
+#define SYSTICK_MAX_TICKS               ((SYSTICK_MAX_RELOAD + 1) / SYSTICK_PERIOD)
+#define SYSTICK_RELOAD_SPINS            64
 
 #define SHPR3                           0xE000ED20
 #define SHPR3_PENDSV_PRIO_OFFSET        2
+#define SHPR3_SYSTICK_PRIO_OFFSET       3
 
 #define THUMB_MASK                      (1 << 24)
 #define NEW_TASK_PSR                    THUMB_MASK
@@ -43,13 +60,12 @@ static const char* const reg_names[] = {
     [R10_REG] = "R10",
     [R11_REG] = "R11",
     [R12_REG] = "R12",
-    [SP_REG] = "SP",
     [LR_REG] = "LR",
     [PC_REG] = "PC",
     [PSR_REG] = "PSR",
     [EXC_RETURN_REG] = "EXC_RETURN",
     [BASEPRI_REG] = "BASEPRI",
-    [REENT_REG] = "REENT",
+    [CONTROL_REG] = "CONTROL",
 };
 #endif
 
@@ -57,8 +73,27 @@ extern struct task *current;
 extern bool need_resched;
 
 uint64_t scheduler_ticks;
+
+/*
+ * Copies of scheduler_ticks for the readers. scheduler_seq also covers the
+ * SysTick registers and the tickless state, which are only changed while the
+ * count is odd.
+ */
+uint64_t scheduler_ticks_latch[2];
+struct seqcount scheduler_seq = SEQCOUNT_INIT;
 void watchdog_check_expired(void);
 
+#ifdef CONFIG_TICKLESS
+/*
+ * Number of ticks the SysTick has been programmed to sleep for, 0 when the
+ * periodic tick is running.
+ */
+static uint32_t tickless_ticks;
+
+/* Cycles elapsed since the last tick boundary when the tickless mode began */
+static uint32_t tickless_offset;
+#endif
+
 void scheduler_arch_init(void)
 {
     scheduler_ticks = 0;
@@ -66,32 +101,258 @@ void scheduler_arch_init(void)
     /* lower the priority of PendSV */
     write8(SHPR3 + SHPR3_PENDSV_PRIO_OFFSET, 255);
 
-#define STRVR 0xE000E014
-    write32(STRVR, CPU_FREQ / HZ);
+    /* the tick handler calls into the kernel, keep it under the ceiling */
+    write8(SHPR3 + SHPR3_SYSTICK_PRIO_OFFSET, CONFIG_IRQ_KERNEL_PRIORITY);
 
-#define STCSR                0xE000E010
-#define STCSR_SYSTICK_ENABLE (1 << 0)
-#define STCSR_TICKINT        (1 << 1)
-#define STCSR_CLKSOURCE      (1 << 2)
+    write32(STRVR, SYSTICK_PERIOD - 1);
+    write32(STCVR, 0);
     write32(STCSR, STCSR_SYSTICK_ENABLE | STCSR_TICKINT | STCSR_CLKSOURCE);
 }
 
+/*
+ * Updates of scheduler_ticks, of the SysTick registers and of the tickless
+ * state must happen between these two calls.
+ */
+static void clock_update_begin(void)
+{
+    write_seqcount_latch(&scheduler_seq);
+}
+
+static void clock_update_end(void)
+{
+    scheduler_ticks_latch[0] = scheduler_ticks;
+    write_seqcount_latch(&scheduler_seq);
+    scheduler_ticks_latch[1] = scheduler_ticks;
+}
+
+/*
+ * Cycles elapsed since the tick boundary of scheduler_ticks, which can span
+ * several ticks while tickless.
+ *
+ * Only meaningful when no update of the SysTick is in progress
+ */
+static uint32_t systick_elapsed(void)
+{
+    uint32_t elapsed = 0;
+    uint32_t reload;
+    uint32_t value;
+
+    reload = read32(STRVR);
+    value = read32(STCVR);
+
+    /* the counter wrapped but the SysTick handler has not run yet */
+    if (read32(ICSR) & ICSR_PENDSTSET) {
+        value = read32(STCVR);
+        elapsed += reload + 1;
+    }
+
+#ifdef CONFIG_TICKLESS
+    if (tickless_ticks)
+        elapsed += tickless_offset;
+#endif
+
+    return elapsed + reload - value;
+}
+
+uint64_t get_tick_cycles(uint32_t *cycles)
+{
+    uint64_t ticks;
+    uint32_t elapsed;
+    uint32_t seq;
+
+    do {
+        seq = read_seqcount_latch(&scheduler_seq);
+        ticks = scheduler_ticks_latch[seq & 1];
+
+        /* interrupting an update, the SysTick state may be half written */
+        elapsed = seq & 1 ? 0 : systick_elapsed();
+    } while (read_seqcount_latch_retry(&scheduler_seq, seq));
+
+    if (elapsed >= SYSTICK_PERIOD) {
+        ticks += elapsed / SYSTICK_PERIOD;
+        elapsed %= SYSTICK_PERIOD;
+    }
+
+    *cycles = elapsed;
+    return ticks;
+}
+
+uint32_t get_cycles_raw(void)
+{
+    return (uint32_t) scheduler_ticks * SYSTICK_PERIOD + systick_elapsed();
+}
+
+uint64_t get_cycles(void)
+{
+    uint32_t cycles;
+    uint64_t ticks = get_tick_cycles(&cycles);
+
+    return ticks * SYSTICK_PERIOD + cycles;
+}
+
+/*
+ * Sleep with PRIMASK set: the interrupt waking the core up is only taken once
+ * the wake-up time has been sampled, so its handler is not counted as idle
+ * time. BASEPRI has to be clear, WFI ignores the interrupts it masks.
+ */
+uint64_t cpu_idle(void)
+{
+    uint64_t start;
+    uint64_t end;
+
+    asm volatile("cpsid i" ::: "memory");
+    start = get_cycles();
+    asm volatile("dsb\n\t"
+                 "wfi" ::: "memory");
+    end = get_cycles();
+    asm volatile("cpsie i" ::: "memory");
+
+    return end - start;
+}
+
+#ifdef CONFIG_TICKLESS
+/*
+ * Restart the periodic tick so that the next tick happens in `first` cycles.
+ *
+ * The counter reloads from STRVR on the clock following the write to STCVR,
+ * so STRVR can be set back to the periodic value once the counter has been
+ * reloaded with the value of the shortened first period. A reload value of 0
+ * would stop the SysTick, `first` must be at least 2.
+ */
+static void systick_restart(uint32_t first)
+{
+    write32(STRVR, first - 1);
+    write32(STCVR, 0);
+    for (int i = 0; i < SYSTICK_RELOAD_SPINS && !read32(STCVR); i++)
+        ;
+    write32(STRVR, SYSTICK_PERIOD - 1);
+}
+
+/*
+ * Program the SysTick to fire at the earliest watchdog expiry instead of
+ * every tick. Only called when the idle task is about to run.
+ *
+ * Must be called with the interrupts disabled
+ */
+static void tickless_start(void)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t delta;
+    uint32_t offset;
+
+    if (tickless_ticks || read32(ICSR) & ICSR_PENDSTSET)
+        return;
+
+#ifdef CONFIG_SCHEDULER_WATCHDOG
+    next = watchdog_next_expiry();
+#endif
+
+    if (next <= scheduler_ticks + 1)
+        return;
+
+    delta = next - scheduler_ticks;
+    if (delta > SYSTICK_MAX_TICKS)
+        delta = SYSTICK_MAX_TICKS;
+
+    clock_update_begin();
+
+    offset = SYSTICK_PERIOD - 1 - read32(STCVR);
+
+    write32(STRVR, delta * SYSTICK_PERIOD - offset - 1);
+    write32(STCVR, 0);
+
+    tickless_offset = offset;
+    tickless_ticks = delta;
+
+    clock_update_end();
+}
+
+/*
+ * Account for the ticks elapsed since tickless_start() and go back to the
+ * periodic tick, aligned on the tick boundaries we would have had without
+ * the tickless mode.
+ *
+ * Must be called with the interrupts disabled
+ */
+static void tickless_stop(void)
+{
+    uint32_t reload = read32(STRVR) + 1;
+    uint32_t elapsed;
+    uint32_t ticks;
+    uint32_t first;
+    uint32_t value;
+    bool wrapped;
+
+    clock_update_begin();
+
+    /*
+     * Reading STCSR clears COUNTFLAG. It is sampled again after STCVR so that
+     * a wrap in between is seen, in which case STCVR is read once more after
+     * the wrap.
+     */
+    wrapped = read32(STCSR) & STCSR_COUNTFLAG;
+    value = read32(STCVR);
+    if (read32(STCSR) & STCSR_COUNTFLAG) {
+        wrapped = true;
+        value = read32(STCVR);
+    }
+
+    elapsed = tickless_offset + reload - 1 - value;
+    if (wrapped)
+        elapsed += reload;
+
+    /* the wrap, if any, is accounted for above */
+    write32(ICSR, ICSR_PENDSTCLR);
+
+    ticks = elapsed / SYSTICK_PERIOD;
+    first = SYSTICK_PERIOD - (elapsed - ticks * SYSTICK_PERIOD);
+
+    /* too close to the next tick to reprogram, merge it into the following */
+    if (first < 2) {
+        first += SYSTICK_PERIOD;
+        ticks++;
+    }
+
+    scheduler_ticks += ticks;
+    systick_restart(first);
+
+    tickless_ticks = 0;
+
+    clock_update_end();
+}
+
+void tickless_exit(void)
+{
+    irq_disable();
+    if (tickless_ticks)
+        tickless_stop();
+    irq_enable();
+}
+#endif
+
+/*
+ * Build the initial context of the task directly on its stack, as if it had
+ * been saved by SAVE_CONTEXT, so that the first switch to the task is the
+ * same as any other switch.
+ */
 void task_init_registers(struct task *task, void *task_entry, void *data,
                          uint32_t stack_addr)
 {
-    memset(&task->registers, 0, sizeof(task->registers));
-    task->registers[SP_REG] = stack_addr - sizeof(struct _reent);
-    task->registers[PC_REG] = ((uint32_t) task_entry) & ~1; /* Store PC as ARM addr */
-    task->registers[LR_REG] = (uint32_t) task_exit;
-    task->registers[PSR_REG] = NEW_TASK_PSR;
-    task->registers[EXC_RETURN_REG] = RETURN_TO_SUPERVISOR_THREAD;
-    task->registers[R0_REG] = (uint32_t) data;
+    uint32_t *context;
 
-    /* init task's libc */
-    task->registers[REENT_REG] = task->registers[SP_REG];
-    _REENT_INIT_PTR((struct _reent*) task->registers[REENT_REG]);
+    /* the task gets its own libc state only on demand, see task_reent_init() */
+    task->reent = _global_impure_ptr;
 
-    task->registers[SP_REG] -= sizeof(task->registers);
+    /* the exception frame must be 8-byte aligned */
+    context = (uint32_t*) (stack_addr & ~7) - MAX_REG;
+    memset(context, 0, MAX_REG * sizeof(*context));
+    context[PC_REG] = ((uint32_t) task_entry) & ~1; /* Store PC as ARM addr */
+    context[LR_REG] = (uint32_t) task_exit;
+    context[PSR_REG] = NEW_TASK_PSR;
+    context[EXC_RETURN_REG] = RETURN_TO_SUPERVISOR_THREAD;
+    context[R0_REG] = (uint32_t) data;
+
+    task->sp = context;
 }
 
 void task_yield(void)
@@ -100,9 +361,25 @@ void task_yield(void)
     write32(ICSR, read32(ICSR) | ICSR_PENDSVSET);
 }
 
-uint32_t systick_handler(uint32_t *stack_top)
+static void systick_tick(void)
 {
+    clock_update_begin();
     scheduler_ticks++;
+    clock_update_end();
+}
+
+uint32_t systick_handler(uint32_t *stack_top)
+{
+#ifdef CONFIG_TICKLESS
+    irq_disable();
+    if (tickless_ticks)
+        tickless_stop();
+    else
+        systick_tick();
+    irq_enable();
+#else
+    systick_tick();
+#endif
 
 #ifdef CONFIG_SCHEDULER_WATCHDOG
     watchdog_check_expired();
@@ -111,13 +388,19 @@ uint32_t systick_handler(uint32_t *stack_top)
     uint32_t exception = stack_top[PSR_REG] & PSR_ISR_NUM_MASK;
     if (exception == EXCEPTION_THREAD_MODE) {
         schedule(stack_top);
+#ifdef CONFIG_TICKLESS
+        irq_disable();
+        if (current->id == 0)
+            tickless_start();
+        irq_enable();
+#endif
     } else {
         write32(ICSR, read32(ICSR) | ICSR_PENDSVSET);
         need_resched = true;
-        return (uint32_t) (stack_top + 1);
+        return (uint32_t) stack_top;
     }
 
-    return current->registers[SP_REG];
+    return (uint32_t) current->sp;
 }
 
 uint32_t pendsv_handler(uint32_t *stack_top)
@@ -126,10 +409,21 @@ uint32_t pendsv_handler(uint32_t *stack_top)
 
     irq_disable();
 
+#ifdef CONFIG_TICKLESS
+    /* woken up by an interrupt before the end of the tickless period */
+    if (tickless_ticks)
+        tickless_stop();
+#endif
+
     if (need_resched)
         schedule(stack_top);
 
-    sp = current->registers[SP_REG];
+#ifdef CONFIG_TICKLESS
+    if (current->id == 0)
+        tickless_start();
+#endif
+
+    sp = (uint32_t) current->sp;
 
     irq_enable();
 
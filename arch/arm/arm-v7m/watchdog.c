@@ -7,112 +7,446 @@
 
 #include <string.h>
 #include <assert.h>
-#include <stdlib.h>
 
+#include <config.h>
 #include <asm/spinlock.h>
 #include <asm/machine.h>
 #include <asm/scheduler.h>
+#include <asm/bitops.h>
 #include <phabos/list.h>
 #include <phabos/watchdog.h>
+#include <phabos/div64.h>
+#include <phabos/scheduler.h>
+#include <phabos/semaphore.h>
+#include <phabos/waiter.h>
 
-static struct list_head wdog_head = LIST_INIT(wdog_head);
+/*
+ * Armed watchdogs are kept in a hierarchical timing wheel. Level 0 has one
+ * slot per tick for the next WHEEL_SIZE ticks, each slot of level n covers
+ * WHEEL_SIZE^n ticks. When the level 0 index wraps, the next slot of level 1
+ * is cascaded into level 0, and so on up the levels. Insertion and removal
+ * are O(1), and a tick only touches the watchdogs expiring on it plus, now
+ * and then, the ones of a single cascaded slot.
+ *
+ * Watchdogs further away than the range of the wheel are parked in the last
+ * slot they can reach, and cascade down from there.
+ *
+ * The tick handler only moves the expired watchdogs to a pending list. Their
+ * callbacks are run by the watchdog task, so they can take as long as they
+ * want and use blocking primitives without delaying the tick.
+ */
+
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_MAX_DELTA ((1ull << (WHEEL_LEVELS * WHEEL_BITS)) - 1)
+
+#define USEC_PER_TICK   (1000000 / HZ)
+#define CYCLES_PER_TICK (CPU_FREQ / HZ)
+#define CYCLES_PER_USEC (CPU_FREQ / 1000000)
+#define SLOT_PENDING    UINT16_MAX
+
+static struct list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint32_t wheel_bitmap[WHEEL_LEVELS][WHEEL_SIZE / 32];
+static uint64_t wheel_ticks; /* next tick to process */
+static unsigned wheel_count;
+static bool wheel_initialized;
 static struct spinlock wdog_lock = SPINLOCK_INIT(wdog_lock);
+static struct list_head wdog_pending = LIST_INIT(wdog_pending);
+static struct semaphore wdog_semaphore =
+    SEMAPHORE_INIT(wdog_semaphore, 0);
+
+/* watchdog whose callback is running, and the tasks waiting for it to end */
+static struct watchdog *wdog_running;
+static struct list_head wdog_sync_waiters = LIST_INIT(wdog_sync_waiters);
+
+#ifdef CONFIG_BENCH
+static uint32_t tick_cycles;
+static uint32_t tick_count;
+#endif
+
+static void wheel_init(void)
+{
+    for (int i = 0; i < WHEEL_LEVELS; i++)
+        for (int j = 0; j < WHEEL_SIZE; j++)
+            list_init(&wheel[i][j]);
+    wheel_initialized = true;
+}
+
+/* Must be called with wdog_lock held, for all the wheel helpers */
+static void wheel_add(struct watchdog *wd)
+{
+    uint64_t expires = wd->node.end;
+    uint64_t delta;
+    unsigned level;
+    unsigned slot;
+
+    if (expires < wheel_ticks)
+        expires = wheel_ticks;
+
+    delta = expires - wheel_ticks;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        expires = wheel_ticks + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ull << ((level + 1) * WHEEL_BITS)))
+            break;
+    }
 
-struct watchdog_priv {
+    slot = (expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+
+    list_add(&wheel[level][slot], &wd->node.list);
+    wheel_bitmap[level][slot / 32] |= 1u << (slot % 32);
+    wd->node.slot = level * WHEEL_SIZE + slot;
+}
+
+static void wheel_del(struct watchdog *wd)
+{
+    unsigned level = wd->node.slot / WHEEL_SIZE;
+    unsigned slot = wd->node.slot % WHEEL_SIZE;
+
+    list_del(&wd->node.list);
+    if (list_is_empty(&wheel[level][slot]))
+        wheel_bitmap[level][slot / 32] &= ~(1u << (slot % 32));
+}
+
+static void wheel_cascade(unsigned level, unsigned slot)
+{
     struct watchdog *wd;
-    struct list_head list;
-    uint64_t start;
-    uint64_t end;
-};
 
-#define to_watchdog_priv(x) ((struct watchdog_priv*) wd->priv)
+    list_foreach_safe(&wheel[level][slot], iter) {
+        wd = list_entry(iter, struct watchdog, node.list);
+        list_del(&wd->node.list);
+        wheel_add(wd);
+    }
+
+    wheel_bitmap[level][slot / 32] &= ~(1u << (slot % 32));
+}
 
-bool watchdog_has_expired(struct watchdog *wd)
+/* Remove a watchdog from the wheel or from the pending list, if it is queued */
+static void wdog_unlink(struct watchdog *wd)
 {
-    assert(wd);
-    assert(wd->priv);
+    if (list_is_empty(&wd->node.list))
+        return;
 
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
+    if (wd->node.slot == SLOT_PENDING) {
+        list_del(&wd->node.list);
+        return;
+    }
 
-    uint64_t ticks = get_ticks();
-    if (wdog->end > wdog->start) {
-        return ticks >= wdog->end;
+    wheel_del(wd);
+    wheel_count--;
+}
+
+/*
+ * Find the first non-empty slot of a level, starting from `start` and
+ * wrapping around.
+ *
+ * Returns the distance from `start` in slots, or -1 if the level is empty
+ */
+static int wheel_find_next(unsigned level, unsigned start)
+{
+    unsigned slot;
+    uint32_t word;
+
+    for (unsigned i = 0; i < WHEEL_SIZE; i += 32 - slot % 32) {
+        slot = (start + i) & WHEEL_MASK;
+        word = wheel_bitmap[level][slot / 32] >> (slot % 32);
+        if (word)
+            return i + ctz(word);
+    }
+
+    return -1;
+}
+
+/*
+ * Round a deadline up to the tick with the most trailing zeros in
+ * [expires, expires + slack]: the highest bit differing between both ends
+ * is set in the upper end, and everything below it can be cleared.
+ */
+static uint64_t wdog_apply_slack(uint64_t expires, uint32_t slack)
+{
+    uint64_t limit = expires + slack;
+    uint64_t diff = expires ^ limit;
+    uint32_t high = limit >> 32;
+    uint32_t low = limit;
+
+    if (!slack)
+        return expires;
+
+    if (diff >> 32) {
+        high &= ~((1u << (31 - clz(diff >> 32))) - 1);
+        low = 0;
     } else {
-        return ticks >= wdog->end && ticks < wdog->start;
+        low &= ~((1u << (31 - clz(diff))) - 1);
     }
 
-    return false;
+    return ((uint64_t) high << 32) | low;
+}
+
+/*
+ * Pick the deadline of a watchdog allowed to expire up to `slack` ticks late.
+ * Joining a tick on which other watchdogs already expire is preferred, this
+ * only needs a look at the level 0 bitmap. Otherwise, the deadline is rounded
+ * so that later watchdogs with overlapping windows can join it.
+ */
+static uint64_t wdog_coalesce(uint64_t expires, uint32_t slack)
+{
+    int distance;
+
+    if (!slack)
+        return expires;
+
+    if (expires < wheel_ticks)
+        expires = wheel_ticks;
+
+    if (expires - wheel_ticks < WHEEL_SIZE) {
+        distance = wheel_find_next(0, expires & WHEEL_MASK);
+        if (distance >= 0 && (uint32_t) distance <= slack &&
+            expires + distance < wheel_ticks + WHEEL_SIZE)
+            return expires + distance;
+    }
+
+    return wdog_apply_slack(expires, slack);
+}
+
+bool watchdog_has_expired(struct watchdog *wd)
+{
+    assert(wd);
+    return get_ticks() >= wd->node.end;
 }
 
 /**
  * Executed from the SYSTICK interrupt
+ *
+ * Processes every tick elapsed since the last call, which can be more than
+ * one after a tickless sleep.
  */
 void watchdog_check_expired(void)
 {
-    list_foreach_safe(&wdog_head, iter) {
-        struct watchdog_priv *wdog =
-            list_entry(iter, struct watchdog_priv, list);
-        struct watchdog *wd = wdog->wd;
+    struct watchdog *wd;
+    uint64_t ticks = get_ticks();
+    unsigned slot;
+    bool wake = false;
 
-        if (!watchdog_has_expired(wd))
-            continue;
+#ifdef CONFIG_BENCH
+    uint64_t start = get_cycles();
+#endif
+
+    spinlock_lock(&wdog_lock);
+
+    if (!wheel_count)
+        wheel_ticks = ticks + 1;
 
-        watchdog_cancel(wd);
-        wd->timeout(wd); // FIXME call from a thread
+    while (wheel_ticks <= ticks) {
+        slot = wheel_ticks & WHEEL_MASK;
+
+        for (unsigned level = 1; !slot && level < WHEEL_LEVELS; level++) {
+            slot = (wheel_ticks >> (level * WHEEL_BITS)) & WHEEL_MASK;
+            wheel_cascade(level, slot);
+        }
+
+        slot = wheel_ticks & WHEEL_MASK;
+        while (!list_is_empty(&wheel[0][slot])) {
+            wd = list_first_entry(&wheel[0][slot], struct watchdog, node.list);
+            wheel_del(wd);
+            wheel_count--;
+
+            if (list_is_empty(&wdog_pending))
+                wake = true;
+            list_add(&wdog_pending, &wd->node.list);
+            wd->node.slot = SLOT_PENDING;
+        }
+
+        wheel_ticks++;
+    }
+
+#ifdef CONFIG_BENCH
+    tick_cycles += get_cycles() - start;
+    tick_count++;
+#endif
+
+    spinlock_unlock(&wdog_lock);
+
+    if (wake)
+        semaphore_unlock(&wdog_semaphore);
+}
+
+/*
+ * Runs the callbacks of the expired watchdogs, in expiry order. The lock is
+ * released around each callback so it can re-arm or cancel any watchdog.
+ */
+static void watchdog_task(void *data)
+{
+    struct watchdog *wd;
+    struct waiter *waiter;
+
+    while (1) {
+        semaphore_lock(&wdog_semaphore);
+
+        spinlock_lock(&wdog_lock);
+        while (!list_is_empty(&wdog_pending)) {
+            wd = list_first_entry(&wdog_pending, struct watchdog, node.list);
+            list_del(&wd->node.list);
+            wdog_running = wd;
+
+            spinlock_unlock(&wdog_lock);
+            wd->timeout(wd);
+            spinlock_lock(&wdog_lock);
+
+            wdog_running = NULL;
+            while ((waiter = waiter_first(&wdog_sync_waiters)))
+                waiter_wake(waiter);
+        }
+        spinlock_unlock(&wdog_lock);
     }
 }
 
+DEFINE_TASK(watchdog, watchdog_task, CONFIG_WATCHDOG_TASK_STACK_SIZE,
+            CONFIG_WATCHDOG_TASK_PRIORITY);
+
+#ifdef CONFIG_BENCH
+void watchdog_get_tick_stats(uint32_t *cycles, uint32_t *count)
+{
+    spinlock_lock(&wdog_lock);
+    *cycles = tick_cycles;
+    *count = tick_count;
+    spinlock_unlock(&wdog_lock);
+}
+#endif
+
+void watchdog_start_at(struct watchdog *wd, uint64_t tick)
+{
+    assert(wd);
+
+    tickless_exit();
+
+    spinlock_lock(&wdog_lock);
+    wdog_unlink(wd);
+    wd->node.end = wdog_coalesce(tick, wd->node.slack);
+    wheel_count++;
+    wheel_add(wd);
+    spinlock_unlock(&wdog_lock);
+}
+
+/*
+ * The part of the current tick already elapsed is counted in, so that the
+ * watchdog never expires before `usec` microseconds.
+ */
 void watchdog_start(struct watchdog *wd, unsigned long usec)
 {
+    uint64_t ticks;
+    uint64_t delay;
+    uint32_t cycles;
+    uint32_t rem;
+
     assert(wd);
-    assert(wd->priv);
     assert(usec > 0);
 
-    uint64_t ticks = get_ticks();
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
+    tickless_exit();
 
-    wdog->start = ticks;
-#define ONE_SEC_IN_USEC 1000000
-    wdog->end = ticks + (usec / ONE_SEC_IN_USEC) * HZ;
-    if (wdog->end == ticks)
-        wdog->end = ticks + 1;
+    ticks = get_tick_cycles(&cycles);
+    delay = div_u64_rem((uint64_t) usec * CYCLES_PER_USEC + cycles,
+                        CYCLES_PER_TICK, &rem);
+    if (rem)
+        delay++;
+
+    watchdog_start_at(wd, ticks + delay);
+}
+
+/*
+ * The watchdogs of level 0 expire exactly on their slot. For the upper
+ * levels, the time their slot gets cascaded is a lower bound of their expiry.
+ */
+uint64_t watchdog_next_expiry(void)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t expiry;
+    uint64_t base;
+    unsigned shift;
+    int distance;
 
     spinlock_lock(&wdog_lock);
-    list_add(&wdog_head, &wdog->list);
+
+    for (unsigned level = 0; wheel_count && level < WHEEL_LEVELS; level++) {
+        shift = level * WHEEL_BITS;
+        base = wheel_ticks >> shift;
+
+        distance = wheel_find_next(level, base & WHEEL_MASK);
+        if (distance < 0)
+            continue;
+
+        expiry = (base + distance) << shift;
+        if (expiry < wheel_ticks)
+            expiry += (uint64_t) WHEEL_SIZE << shift;
+
+        if (expiry < next)
+            next = expiry;
+    }
+
     spinlock_unlock(&wdog_lock);
+
+    return next;
 }
 
-void watchdog_cancel(struct watchdog *wd)
+static bool in_exception(void)
 {
-    assert(wd);
-    assert(wd->priv);
+    uint32_t ipsr;
 
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
+    asm volatile("mrs %0, ipsr" : "=r"(ipsr));
+    return ipsr != 0;
+}
+
+/*
+ * Like Linux's del_timer_sync(): a callback already running is waited for,
+ * unless the caller is the watchdog task itself or an interrupt handler,
+ * which could never let it finish.
+ */
+bool watchdog_cancel(struct watchdog *wd)
+{
+    extern struct static_task __static_task_watchdog;
+    struct waiter waiter;
+    bool running;
+
+    assert(wd);
 
     spinlock_lock(&wdog_lock);
-    if (!list_is_empty(&wdog->list))
-        list_del(&wdog->list);
+
+    wdog_unlink(wd);
+
+    running = wdog_running == wd;
+    if (running && !in_exception() &&
+        task_get_running() != &__static_task_watchdog.task) {
+        while (wdog_running == wd)
+            waiter_wait(&wdog_sync_waiters, &waiter);
+        running = false;
+    }
+
     spinlock_unlock(&wdog_lock);
+
+    return running;
 }
 
-void watchdog_init(struct watchdog *wd)
+void watchdog_set_slack(struct watchdog *wd, unsigned long usec)
 {
-    struct watchdog_priv *wdog;
-
     assert(wd);
-    memset(wd, 0, sizeof(*wd));
-    wd->priv = wdog = malloc(sizeof(*wdog));
-    list_init(&wdog->list);
-    wdog->wd = wd;
+
+    /* rounded up, so that a slack shorter than a tick is not lost */
+    wd->node.slack = (usec + USEC_PER_TICK - 1) / USEC_PER_TICK;
 }
 
-void watchdog_delete(struct watchdog *wd)
+void watchdog_init(struct watchdog *wd)
 {
-    if (!wd)
-        return;
+    assert(wd);
 
-    assert(wd->priv);
+    spinlock_lock(&wdog_lock);
+    if (!wheel_initialized)
+        wheel_init();
+    spinlock_unlock(&wdog_lock);
 
-    watchdog_cancel(wd);
-    free(wd->priv);
+    memset(wd, 0, sizeof(*wd));
+    list_init(&wd->node.list);
 }
@@ -56,8 +56,12 @@ enum semihosting_syscall {
     SYSCALL_WRITEC = 0x3,
     SYSCALL_WRITE = 0x5,
     SYSCALL_READ = 0x6,
+    SYSCALL_EXIT = 0x18,
+    SYSCALL_EXIT_EXTENDED = 0x20,
 };
 
+#define ADP_STOPPED_APPLICATION_EXIT    0x20026
+
 static int fd[2];
 
 static uint32_t semihosting_syscall(int syscall, uint32_t *params)
@@ -122,6 +126,26 @@ void semihosting_putc(char c)
     semihosting_syscall(SYSCALL_WRITEC, (uint32_t*) &c32);
 }
 
+void semihosting_exit(int status)
+{
+    uint32_t params[] = {
+        ADP_STOPPED_APPLICATION_EXIT,
+        (uint32_t) status,
+    };
+
+    /*
+     * SYS_EXIT can only report success on 32-bit targets, the exit code
+     * requires SYS_EXIT_EXTENDED.
+     */
+    if (!status)
+        semihosting_syscall(SYSCALL_EXIT,
+                            (uint32_t*) ADP_STOPPED_APPLICATION_EXIT);
+    else
+        semihosting_syscall(SYSCALL_EXIT_EXTENDED, &params[0]);
+
+    while (1);
+}
+
 void semihosting_init(void)
 {
     fd[SEMIHOSTING_READ_STREAM] = semihosting_open(":tt", READ_MODE);
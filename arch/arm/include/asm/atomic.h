@@ -26,5 +26,13 @@ uint32_t atomic_add(atomic_t *atomic, int n);
 uint32_t atomic_inc(atomic_t *atomic);
 uint32_t atomic_dec(atomic_t *atomic);
 
+/**
+ * Atomically replace the value of `atomic` by `new` if it is equal to `old`
+ *
+ * Returns the value of `atomic` before the operation, the exchange happened
+ * if it is equal to `old`.
+ */
+uint32_t atomic_cmpxchg(atomic_t *atomic, uint32_t old, uint32_t new);
+
 #endif /* __ATOMIC_H__ */
 
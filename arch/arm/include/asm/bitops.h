@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __ARM_BITOPS_H__
+#define __ARM_BITOPS_H__
+
+#include <stdint.h>
+
+/**
+ * Count the leading zeros of a 32-bit word
+ *
+ * Returns 32 when x is 0.
+ */
+static inline unsigned clz(uint32_t x)
+{
+    unsigned n;
+
+    asm("clz %0, %1" : "=r"(n) : "r"(x));
+    return n;
+}
+
+/**
+ * Count the trailing zeros of a 32-bit word
+ *
+ * Returns 32 when x is 0.
+ */
+static inline unsigned ctz(uint32_t x)
+{
+    return x ? 31 - clz(x & -x) : 32;
+}
+
+#endif /* __ARM_BITOPS_H__ */
@@ -8,6 +8,8 @@
 #ifndef __ARM_IRQ_H__
 #define __ARM_IRQ_H__
 
+#include <stdint.h>
+
 struct irq_handler {
     void (*handler)(int line, void *data);
     void *data;
@@ -16,8 +18,24 @@ struct irq_handler {
 typedef void (*irq_handler_t)(int line, void *data);
 
 void irq_initialize(void);
+
+/**
+ * Enter/leave a kernel critical section, calls can be nested
+ *
+ * Only the interrupts whose priority is lower than or equal to the kernel
+ * priority ceiling (CONFIG_IRQ_KERNEL_PRIORITY) are masked.
+ */
 void irq_disable(void);
 void irq_enable(void);
+
+/**
+ * Set the priority of an interrupt line
+ *
+ * Every line starts at the kernel priority ceiling. A line given a higher
+ * priority (a numerically lower value) is never masked by the kernel, so its
+ * handler must not call any kernel function.
+ */
+void irq_set_priority(int line, uint8_t priority);
 void irq_enable_line(int line);
 void irq_disable_line(int line);
 int irq_attach(int line, irq_handler_t handler, void *data);
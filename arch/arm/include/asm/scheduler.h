@@ -8,17 +8,21 @@
 #ifndef __ARM_SCHEDULER_H__
 #define __ARM_SCHEDULER_H__
 
+#include <config.h>
 #include <stdint.h>
 #include <asm/irq.h>
+#include <phabos/seqcount.h>
 
 typedef uint32_t register_t;
 struct task;
 
+/*
+ * Layout of a task context saved on its stack: the registers pushed by
+ * SAVE_CONTEXT followed by the exception frame pushed by the hardware.
+ */
 enum register_offset
 {
-    SP_REG = 0,
-    REENT_REG,
-    R4_REG,
+    R4_REG = 0,
     R5_REG,
     R6_REG,
     R7_REG,
@@ -41,18 +45,86 @@ enum register_offset
     MAX_REG,
 };
 
+/*
+ * Smallest stack a task can be given: its initial context and a margin for
+ * the first calls it makes. The libc state is allocated on the heap, see
+ * task_reent_init().
+ */
+#define TASK_STACK_MARGIN       256
+#define TASK_STACK_MIN          (MAX_REG * sizeof(uint32_t) + TASK_STACK_MARGIN)
+
+/*
+ * The tick count is published to readers through a latch, so reading it
+ * never masks the interrupts nor waits for the tick handler.
+ */
 static inline uint64_t get_ticks(void)
 {
+    extern uint64_t scheduler_ticks_latch[2];
+    extern struct seqcount scheduler_seq;
     uint64_t ticks;
-    extern uint64_t scheduler_ticks;
+    uint32_t seq;
 
-    irq_disable();
-    ticks = scheduler_ticks;
-    irq_enable();
+    do {
+        seq = read_seqcount_latch(&scheduler_seq);
+        ticks = scheduler_ticks_latch[seq & 1];
+    } while (read_seqcount_latch_retry(&scheduler_seq, seq));
 
     return ticks;
 }
 
+/**
+ * Get the number of CPU cycles elapsed since the scheduler started
+ *
+ * Combines the tick count with the current value of the SysTick, giving a
+ * sub-tick resolution timestamp.
+ */
+uint64_t get_cycles(void);
+
+/**
+ * Get the tick count along with the cycles elapsed since that tick
+ *
+ * Same clock as get_cycles(), split so that it can be converted to time
+ * without dividing 64-bit numbers. `cycles` is always lower than
+ * CPU_FREQ / HZ.
+ *
+ * Never waits: a caller interrupting an update of the tick, which only
+ * handlers above the kernel priority ceiling can do, gets the last published
+ * tick with no cycles, and can lag by up to a tick.
+ */
+uint64_t get_tick_cycles(uint32_t *cycles);
+
+/**
+ * Same clock as get_cycles(), truncated to 32 bits and read without any
+ * synchronization with the tick handler
+ *
+ * Never blocks nor masks the interrupts, so it can be called from any
+ * context, but can be off by a tick when racing with a tick update. Meant
+ * for timestamping trace events.
+ */
+uint32_t get_cycles_raw(void);
+
+/**
+ * Put the core to sleep until the next interrupt
+ *
+ * Returns the number of cycles spent sleeping
+ */
+uint64_t cpu_idle(void);
+
+#ifdef CONFIG_TICKLESS
+/**
+ * Leave the tickless mode and bring scheduler_ticks up to date
+ *
+ * Must be called before reading the ticks or arming a timer from an interrupt
+ * handler, since the tick count is only updated on wakeup while the idle task
+ * sleeps in tickless mode.
+ */
+void tickless_exit(void);
+#else
+static inline void tickless_exit(void)
+{
+}
+#endif
+
 void schedule(uint32_t *stack_top);
 void scheduler_arch_init(void);
 void task_init_registers(struct task *task, void *task_entry, void *data,
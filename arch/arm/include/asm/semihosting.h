@@ -17,5 +17,10 @@ ssize_t semihosting_write(const char *buffer, size_t buflen);
 void semihosting_putc(char c);
 void semihosting_init(void);
 
+/**
+ * Stop the program and have the debugger/emulator exit with `status`
+ */
+void semihosting_exit(int status);
+
 #endif /* __ARM_SEMIHOSTING_H__ */
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <asm/hwio.h>
+#include <asm/irq.h>
+#include <phabos/hrtimer.h>
+
+/* General-Purpose Timer Module 0, timer A used as a 32-bit one-shot timer */
+
+#define SYSCTL_RCGC1        0x400fe104
+#define RCGC1_TIMER0        (1 << 16)
+
+#define TIMER0_BASE         0x40030000
+#define GPTMCFG             (TIMER0_BASE + 0x000)
+#define GPTMTAMR            (TIMER0_BASE + 0x004)
+#define GPTMCTL             (TIMER0_BASE + 0x00c)
+#define GPTMIMR             (TIMER0_BASE + 0x018)
+#define GPTMICR             (TIMER0_BASE + 0x024)
+#define GPTMTAILR           (TIMER0_BASE + 0x028)
+
+#define GPTMCFG_32BIT       0x0
+#define GPTMTAMR_ONE_SHOT   0x1
+#define GPTMCTL_TAEN        (1 << 0)
+#define GPTM_TATO           (1 << 0)
+
+#define TIMER0A_IRQ         19
+
+static void lm3s6965_timer_irq(int line, void *data)
+{
+    write32(GPTMICR, GPTM_TATO);
+    hrtimer_interrupt();
+}
+
+void machine_hrtimer_init(void)
+{
+    write32(SYSCTL_RCGC1, read32(SYSCTL_RCGC1) | RCGC1_TIMER0);
+
+    /* the module needs a few cycles after being clocked before access */
+    read32(SYSCTL_RCGC1);
+
+    write32(GPTMCTL, 0);
+    write32(GPTMCFG, GPTMCFG_32BIT);
+    write32(GPTMTAMR, GPTMTAMR_ONE_SHOT);
+    write32(GPTMICR, GPTM_TATO);
+    write32(GPTMIMR, GPTM_TATO);
+
+    irq_attach(TIMER0A_IRQ, lm3s6965_timer_irq, NULL);
+    irq_enable_line(TIMER0A_IRQ);
+}
+
+void machine_hrtimer_program(uint32_t cycles)
+{
+    write32(GPTMCTL, 0);
+    write32(GPTMICR, GPTM_TATO);
+    write32(GPTMTAILR, cycles);
+    write32(GPTMCTL, GPTMCTL_TAEN);
+}
+
+void machine_hrtimer_stop(void)
+{
+    write32(GPTMCTL, 0);
+    write32(GPTMICR, GPTM_TATO);
+}
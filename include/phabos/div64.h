@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __DIV64_H__
+#define __DIV64_H__
+
+#include <stdint.h>
+
+/**
+ * Divide a 64-bit number by a 32-bit one
+ *
+ * The runtime only provides 32-bit division, this only uses the hardware
+ * divider when the dividend fits in 32 bits and falls back to a shift and
+ * subtract loop otherwise.
+ *
+ * remainder: receives the remainder of the division
+ *
+ * Returns the quotient
+ */
+uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+
+#endif /* __DIV64_H__ */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __EVENT_FLAGS_H__
+#define __EVENT_FLAGS_H__
+
+#include <stdint.h>
+#include <phabos/list.h>
+
+/* Options of event_flags_wait() */
+#define EVENT_FLAGS_ANY         0
+#define EVENT_FLAGS_ALL         (1 << 0)    /* wait for every flag of the mask */
+#define EVENT_FLAGS_CLEAR       (1 << 1)    /* clear the awaited flags on exit */
+
+/*
+ * Group of 32 event flags tasks can wait on
+ */
+struct event_flags {
+    uint32_t flags;
+    struct list_head waiters;
+};
+
+#define EVENT_FLAGS_INIT(x) { \
+    .flags = 0, \
+    .waiters = LIST_INIT((x).waiters), \
+}
+
+void event_flags_init(struct event_flags *ef);
+
+/**
+ * Sleep until any or all of the flags of `mask` are set
+ *
+ * mask: flags to wait for
+ * options: EVENT_FLAGS_ANY or EVENT_FLAGS_ALL, optionally ORed with
+ *          EVENT_FLAGS_CLEAR to clear the flags of `mask` once satisfied
+ *
+ * Returns the flags of the group when the wait got satisfied, before any
+ * clearing
+ */
+uint32_t event_flags_wait(struct event_flags *ef, uint32_t mask,
+                          unsigned options);
+
+/**
+ * Set flags and wake up every waiter they satisfy
+ *
+ * Can be called from interrupt context.
+ *
+ * Returns the flags of the group after the call
+ */
+uint32_t event_flags_set(struct event_flags *ef, uint32_t mask);
+
+/**
+ * Clear flags
+ *
+ * Returns the flags of the group before the call
+ */
+uint32_t event_flags_clear(struct event_flags *ef, uint32_t mask);
+
+static inline uint32_t event_flags_get(struct event_flags *ef)
+{
+    return ef->flags;
+}
+
+#endif /* __EVENT_FLAGS_H__ */
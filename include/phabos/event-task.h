@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __EVENT_TASK_H__
+#define __EVENT_TASK_H__
+
+#include <stdbool.h>
+#include <phabos/list.h>
+
+/*
+ * Event tasks are protothread-style activities without a stack of their own.
+ * They all run to completion on the stack of a single dispatcher task, which
+ * calls their entry point each time they are posted.
+ *
+ * An entry point resumes where it last returned through the ET_* macros.
+ * Local variables are NOT preserved across ET_WAIT_UNTIL() and ET_YIELD(),
+ * state has to live in a structure embedding the struct event_task.
+ *
+ *  static int blink(struct event_task *et)
+ *  {
+ *      struct led *led = containerof(et, struct led, et);
+ *
+ *      ET_BEGIN(et);
+ *      while (1) {
+ *          ET_WAIT_UNTIL(et, led->toggle);
+ *          led->toggle = false;
+ *          led_toggle(led);
+ *      }
+ *      ET_END(et);
+ *  }
+ */
+
+enum event_task_state {
+    ET_WAITING,     /* run again on the next event_task_post() */
+    ET_YIELDED,     /* run again after the other pending event tasks */
+    ET_EXITED,      /* start over from ET_BEGIN() on the next post */
+};
+
+struct event_task;
+typedef int (*event_task_entry_t)(struct event_task *et);
+
+struct event_task {
+    event_task_entry_t entry;
+    void *data;
+    unsigned lc;
+    bool queued;
+    struct list_head list;
+};
+
+#define EVENT_TASK_INIT(x, _entry, _data) { \
+    .entry = _entry, \
+    .data = _data, \
+    .lc = 0, \
+    .queued = false, \
+    .list = LIST_INIT((x).list), \
+}
+
+#define ET_BEGIN(et) switch ((et)->lc) { case 0:
+
+#define ET_END(et) } (et)->lc = 0; return ET_EXITED
+
+#define ET_WAIT_UNTIL(et, cond)                                             \
+    do {                                                                    \
+        (et)->lc = __LINE__;                                                \
+        case __LINE__:                                                      \
+        if (!(cond))                                                        \
+            return ET_WAITING;                                              \
+    } while (0)
+
+#define ET_YIELD(et)                                                        \
+    do {                                                                    \
+        (et)->lc = __LINE__;                                                \
+        return ET_YIELDED;                                                  \
+        case __LINE__:;                                                     \
+    } while (0)
+
+#define ET_EXIT(et)                                                         \
+    do {                                                                    \
+        (et)->lc = 0;                                                       \
+        return ET_EXITED;                                                   \
+    } while (0)
+
+void event_task_init(struct event_task *et, event_task_entry_t entry,
+                     void *data);
+
+/**
+ * Have the dispatcher run an event task
+ *
+ * Posting an event task already pending does nothing. Safe to call from
+ * interrupt context.
+ */
+void event_task_post(struct event_task *et);
+
+#endif /* __EVENT_TASK_H__ */
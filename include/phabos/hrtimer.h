@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __HRTIMER_H__
+#define __HRTIMER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <phabos/list.h>
+
+/*
+ * High resolution timers, with a microsecond resolution independent of HZ.
+ * Deadlines are kept in CPU cycles and a one-shot hardware timer provided by
+ * the machine is programmed for the earliest one. Callbacks are called from
+ * the interrupt of that timer.
+ *
+ * A timer with slack may expire anywhere between `expires` and
+ * `expires + slack`: the hardware timer is programmed for the latest
+ * deadline, and timers whose earliest deadline has passed by then expire
+ * along with it, so that close deadlines share an interrupt.
+ */
+struct hrtimer {
+    void (*callback)(struct hrtimer *timer);
+    void *data;
+    uint64_t expires;
+    uint32_t slack;
+    struct list_head list;
+};
+
+/**
+ * Set up the hardware timer, called once at boot
+ */
+void hrtimers_init(void);
+
+void hrtimer_init(struct hrtimer *timer, void (*callback)(struct hrtimer*),
+                  void *data);
+
+/**
+ * Arm a timer to expire in `usec` microseconds
+ *
+ * Re-arming a pending timer moves its deadline.
+ */
+void hrtimer_start(struct hrtimer *timer, unsigned long usec);
+void hrtimer_cancel(struct hrtimer *timer);
+
+/**
+ * Allow the timer to expire up to `usec` microseconds late
+ *
+ * Timers have no slack by default, the new value applies from the next time
+ * the timer is started.
+ */
+void hrtimer_set_slack(struct hrtimer *timer, unsigned long usec);
+bool hrtimer_is_pending(struct hrtimer *timer);
+
+/*
+ * Implemented by the machine: one-shot timer running at CPU_FREQ, calling
+ * hrtimer_interrupt() when it fires.
+ */
+void machine_hrtimer_init(void);
+void machine_hrtimer_program(uint32_t cycles);
+void machine_hrtimer_stop(void);
+
+void hrtimer_interrupt(void);
+
+#endif /* __HRTIMER_H__ */
@@ -8,6 +8,7 @@
 #ifndef __LIST_H__
 #define __LIST_H__
 
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 
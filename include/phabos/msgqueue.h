@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __MSGQUEUE_H__
+#define __MSGQUEUE_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <phabos/list.h>
+#include <phabos/assert.h>
+
+/*
+ * Queue of fixed-size messages, copied in and out of a ring of `depth`
+ * elements. A sender finding a receiver waiting copies its message straight
+ * into the buffer of the receiver and wakes it up, and the other way around
+ * for a receiver finding a sender waiting on a full queue.
+ *
+ * A queue created with an element size of sizeof(void*) can be used in
+ * pointer mode through msgqueue_send_ptr() and msgqueue_receive_ptr(): only
+ * the pointer is copied and the ownership of the data goes to the receiver.
+ */
+struct msgqueue {
+    uint8_t *buffer;
+    size_t elem_size;
+    unsigned depth;
+    unsigned head;
+    unsigned count;
+    struct list_head senders;
+    struct list_head receivers;
+};
+
+/**
+ * Allocate a message queue and its ring in a single allocation
+ *
+ * Returns NULL if out of memory
+ */
+struct msgqueue *msgqueue_create(size_t elem_size, unsigned depth);
+
+/**
+ * Initialize a message queue using a ring provided by the caller
+ *
+ * buffer: storage for at least elem_size * depth bytes
+ */
+void msgqueue_init(struct msgqueue *mq, void *buffer, size_t elem_size,
+                   unsigned depth);
+
+void msgqueue_destroy(struct msgqueue *mq);
+
+/**
+ * Copy a message into the queue, sleeping while the queue is full
+ */
+void msgqueue_send(struct msgqueue *mq, const void *msg);
+
+/**
+ * Copy a message into the queue if it is not full
+ *
+ * Never blocks and can be called from interrupt context.
+ *
+ * Returns false if the queue is full
+ */
+bool msgqueue_trysend(struct msgqueue *mq, const void *msg);
+
+/**
+ * Copy the oldest message of the queue into `msg`, sleeping while the queue
+ * is empty
+ */
+void msgqueue_receive(struct msgqueue *mq, void *msg);
+
+/**
+ * Same as msgqueue_receive() but returns false instead of sleeping
+ */
+bool msgqueue_tryreceive(struct msgqueue *mq, void *msg);
+
+static inline void msgqueue_send_ptr(struct msgqueue *mq, void *ptr)
+{
+    RET_IF_FAIL(mq && mq->elem_size == sizeof(ptr),);
+
+    msgqueue_send(mq, &ptr);
+}
+
+static inline bool msgqueue_trysend_ptr(struct msgqueue *mq, void *ptr)
+{
+    RET_IF_FAIL(mq && mq->elem_size == sizeof(ptr), false);
+
+    return msgqueue_trysend(mq, &ptr);
+}
+
+static inline void *msgqueue_receive_ptr(struct msgqueue *mq)
+{
+    void *ptr;
+
+    RET_IF_FAIL(mq && mq->elem_size == sizeof(ptr), NULL);
+
+    msgqueue_receive(mq, &ptr);
+    return ptr;
+}
+
+static inline unsigned msgqueue_get_count(struct msgqueue *mq)
+{
+    return mq->count;
+}
+
+#endif /* __MSGQUEUE_H__ */
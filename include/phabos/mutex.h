@@ -8,42 +8,74 @@
 #ifndef __MUTEX_H__
 #define __MUTEX_H__
 
+#include <stdbool.h>
+
+#include <asm/atomic.h>
 #include <phabos/list.h>
-#include <phabos/semaphore.h>
 
+struct task;
+
+/*
+ * owner holds the task owning the mutex, or 0 when the mutex is free. Its
+ * lowest bit is set while tasks are waiting for the mutex, which forces
+ * mutex_unlock() out of its fast path.
+ *
+ * While the mutex has waiters, it is linked through `held` to the list of
+ * contended mutexes held by its owner, which is used to compute the priority
+ * the owner inherits.
+ */
 struct mutex {
-    struct semaphore semaphore;
+    atomic_t owner;
+    struct list_head wait_list;
+    struct list_head held;
 };
 
-static inline struct mutex *mutex_create(void)
-{
-    return (struct mutex*) semaphore_create(1);
+#define MUTEX_INIT(x) { \
+    .owner = 0, \
+    .wait_list = LIST_INIT((x).wait_list), \
+    .held = LIST_INIT((x).held), \
 }
 
-static inline void mutex_init(struct mutex *mutex)
-{
-    semaphore_init((struct semaphore*) mutex, 1);
-}
+struct mutex *mutex_create(void);
+void mutex_init(struct mutex *mutex);
+void mutex_destroy(struct mutex *mutex);
 
-static inline void mutex_lock(struct mutex *mutex)
-{
-    semaphore_lock((struct semaphore*) mutex);
-}
+/**
+ * Lock a mutex
+ *
+ * If the mutex is already locked, the running task sleeps until it is
+ * released and the owner of the mutex inherits the priority of the task if it
+ * is higher than its own. Locking a mutex already owned by the running task
+ * is a deadlock and panics.
+ */
+void mutex_lock(struct mutex *mutex);
 
-static inline void mutex_unlock(struct mutex *mutex)
-{
-    semaphore_unlock((struct semaphore*) mutex);
-}
+/**
+ * Same as mutex_lock() but gives up after `usec` microseconds
+ *
+ * Returns 0 if the mutex has been locked, -ETIMEDOUT otherwise
+ */
+int mutex_lock_timeout(struct mutex *mutex, unsigned long usec);
 
-static inline void mutex_destroy(struct mutex *mutex)
-{
-    semaphore_destroy((struct semaphore*) mutex);
-}
+bool mutex_trylock(struct mutex *mutex);
 
-static inline bool mutex_trylock(struct mutex *mutex)
-{
-    return semaphore_trylock((struct semaphore*) mutex);
-}
+/**
+ * Unlock a mutex
+ *
+ * The ownership of the mutex is handed over to the highest priority waiter,
+ * and the priority of the running task is restored to its base priority, or
+ * to the one it still inherits from the other mutexes it holds.
+ */
+void mutex_unlock(struct mutex *mutex);
 
-#endif /* __MUTEX_H__ */
+/**
+ * Get the priority a task inherits from the waiters of the mutexes it holds
+ *
+ * Returns the highest priority between the base priority of the task and the
+ * ones of the tasks waiting for its mutexes.
+ *
+ * Must be called with the interrupts disabled
+ */
+int mutex_inherited_priority(struct task *task);
 
+#endif /* __MUTEX_H__ */
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __PERIODIC_TIMER_H__
+#define __PERIODIC_TIMER_H__
+
+#include <stdint.h>
+#include <phabos/list.h>
+#include <phabos/watchdog.h>
+
+/*
+ * Periodic timers, built on top of the watchdogs. Each deadline is computed
+ * from the previous one rather than from the time the callback ran, so the
+ * latency of the callbacks never accumulates as drift. Deadlines that are
+ * missed entirely are skipped and counted as overruns.
+ *
+ * Callbacks run from the watchdog task, like the watchdog ones.
+ */
+struct periodic_timer {
+    const char *name;
+    void (*callback)(struct periodic_timer *timer);
+    void *data;
+
+    struct watchdog wd;
+    struct list_head list;
+    uint64_t deadline;
+    uint32_t period;
+
+    /* statistics, the jitter is the delay between deadline and callback */
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t jitter_min;
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+    uint32_t jitter_samples;
+};
+
+void periodic_timer_init(struct periodic_timer *timer, const char *name,
+                         void (*callback)(struct periodic_timer*), void *data);
+
+/**
+ * Start calling the timer callback every `usec` microseconds
+ *
+ * The period is rounded up to a whole number of ticks, and the statistics
+ * are reset. Starting a running timer restarts it.
+ */
+void periodic_timer_start(struct periodic_timer *timer, unsigned long usec);
+void periodic_timer_stop(struct periodic_timer *timer);
+
+#endif /* __PERIODIC_TIMER_H__ */
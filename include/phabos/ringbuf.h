@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __RINGBUF_H__
+#define __RINGBUF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Byte ring buffer for a single producer and a single consumer, which may
+ * run in interrupt context. Only the producer writes `head` and only the
+ * consumer writes `tail`, so no lock and no interrupt masking is needed.
+ *
+ * Both indexes run freely and are masked on access, the capacity must be a
+ * power of two.
+ */
+struct ringbuf {
+    uint8_t *buffer;
+    size_t size;
+    volatile size_t head;
+    volatile size_t tail;
+};
+
+/**
+ * Initialize a ring buffer on storage provided by the caller
+ *
+ * Returns 0 on success, -EINVAL if size is not a power of two
+ */
+int ringbuf_init(struct ringbuf *rb, void *buffer, size_t size);
+
+/**
+ * Allocate a ring buffer and its storage
+ *
+ * Returns NULL if out of memory or if size is not a power of two
+ */
+struct ringbuf *ringbuf_create(size_t size);
+void ringbuf_destroy(struct ringbuf *rb);
+
+/**
+ * Copy up to `len` bytes into the ring buffer (producer side)
+ *
+ * Returns the number of bytes copied
+ */
+size_t ringbuf_enqueue(struct ringbuf *rb, const void *data, size_t len);
+
+/**
+ * Copy up to `len` bytes out of the ring buffer (consumer side)
+ *
+ * Returns the number of bytes copied
+ */
+size_t ringbuf_dequeue(struct ringbuf *rb, void *data, size_t len);
+
+/**
+ * Get the contiguous free space following the head (producer side)
+ *
+ * The producer writes into the span in place then publishes the bytes with
+ * ringbuf_write_commit(). Only a part of the free space is returned when it
+ * wraps around the end of the storage.
+ *
+ * len: set to the size of the span, 0 if the ring buffer is full
+ */
+void *ringbuf_write_span(struct ringbuf *rb, size_t *len);
+void ringbuf_write_commit(struct ringbuf *rb, size_t len);
+
+/**
+ * Get the contiguous data following the tail (consumer side)
+ *
+ * The consumer processes the span in place then releases the bytes with
+ * ringbuf_read_commit(). Only a part of the data is returned when it wraps
+ * around the end of the storage.
+ *
+ * len: set to the size of the span, 0 if the ring buffer is empty
+ */
+const void *ringbuf_read_span(struct ringbuf *rb, size_t *len);
+void ringbuf_read_commit(struct ringbuf *rb, size_t len);
+
+static inline size_t ringbuf_count(struct ringbuf *rb)
+{
+    return rb->head - rb->tail;
+}
+
+static inline size_t ringbuf_space(struct ringbuf *rb)
+{
+    return rb->size - ringbuf_count(rb);
+}
+
+static inline bool ringbuf_is_empty(struct ringbuf *rb)
+{
+    return rb->head == rb->tail;
+}
+
+#endif /* __RINGBUF_H__ */
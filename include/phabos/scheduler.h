@@ -8,19 +8,54 @@
 #ifndef __SCHEDULER_H__
 #define __SCHEDULER_H__
 
+#include <config.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include <asm/scheduler.h>
 #include <phabos/list.h>
 #include <phabos/mutex.h>
+#include <phabos/watchdog.h>
+
+#define TASK_PRIORITY_IDLE              0
+#define TASK_PRIORITY_DEFAULT           8
+#define TASK_PRIORITY_MAX               31
+#define TASK_PRIORITY_COUNT             (TASK_PRIORITY_MAX + 1)
+
+struct _reent;
+
+struct task_stats {
+    uint64_t runtime;
+    uint32_t switch_count;
+    uint32_t voluntary_switches;
+    uint32_t involuntary_switches;
+};
+
+struct task_info {
+    int id;
+    int priority;
+    bool running;
+    struct task_stats stats;
+};
 
 struct task {
     int id;
     uint16_t state;
-    register_t registers[MAX_REG];
+    int priority;
+    int base_priority;
+    uint32_t *sp;
+    struct _reent *reent;
     void *allocated_stack;
+    struct list_head *wait_list;
+    struct mutex *blocked_on;
+    struct list_head held_mutexes;
+#ifdef CONFIG_TASK_STATS
+    struct task_stats stats;
+#endif
 
     struct list_head list;
+    struct list_head all;
 };
 
 struct task_cond {
@@ -29,11 +64,55 @@ struct task_cond {
 
 typedef void (*task_entry_t)(void *data);
 
+/*
+ * Work run by the idle task before it puts the core to sleep. A hook must
+ * never block and should be short, it delays the sleep of the core.
+ */
+struct idle_hook {
+    void (*hook)(void *data);
+    void *data;
+    struct list_head list;
+};
+
+/*
+ * Task declared at link time with DEFINE_TASK(). The descriptors are
+ * collected in the .tasks section and started by scheduler_init().
+ */
+struct static_task {
+    struct task task;
+    task_entry_t entry;
+    uint64_t *stack;
+    size_t stack_size;
+    int priority;
+};
+
+#define __task__ __attribute__((section(".tasks")))
+
+/**
+ * Declare a task started by scheduler_init()
+ *
+ * The task control block and the stack are statically allocated, so the task
+ * needs no allocation at runtime. The entry point is called with NULL.
+ *
+ * name: name of the task, the descriptor is named __static_task_<name>
+ * entry: entry point of the task
+ * stack_size: size of the stack in bytes
+ * priority: same as task_run_priority()
+ */
+#define DEFINE_TASK(name, _entry, _stack_size, _priority)                   \
+    static uint64_t __static_task_##name##_stack[((_stack_size) + 7) / 8];  \
+    __task__ struct static_task __static_task_##name = {                    \
+        .entry = _entry,                                                    \
+        .stack = __static_task_##name##_stack,                              \
+        .stack_size = sizeof(__static_task_##name##_stack),                 \
+        .priority = _priority,                                              \
+    }
+
 /**
  * Initialize the scheduler
  *
  * Must be called before using any of the scheduler functions AND before
- * activating the Systick
+ * activating the Systick. Starts every task declared with DEFINE_TASK().
  */
 void scheduler_init(void);
 
@@ -52,15 +131,52 @@ void task_yield(void);
 void task_kill(struct task *task);
 
 void task_exit(void);
+
+/**
+ * Give the running task its own libc state (errno, stdio streams, ...)
+ *
+ * Tasks start sharing the global libc state, which is enough for tasks that
+ * never use stdio or errno concurrently. Calling this again does nothing.
+ *
+ * Returns 0 on success, -ENOMEM otherwise
+ */
+int task_reent_init(void);
+
+/**
+ * Release the memory of the tasks that exited or have been killed
+ *
+ * Dead tasks are not freed from the context switch path. This is called from
+ * the idle loop, but may be called from any task context.
+ */
+void task_reap_zombies(void);
+
+/**
+ * Register a hook run by the idle task each time before it sleeps
+ *
+ * Hooks stay registered for the lifetime of the system.
+ */
+void idle_hook_register(struct idle_hook *hook);
+
+/**
+ * Turn the calling context into the idle loop
+ *
+ * Called once by main() after scheduler_init(), never returns.
+ */
+void scheduler_idle(void) __attribute__((noreturn));
+
+/**
+ * Get the number of CPU cycles the core spent sleeping in the idle loop
+ */
+uint64_t scheduler_get_idle_cycles(void);
 void task_add_to_wait_list(struct task *task, struct list_head *wait_list);
 void task_remove_from_wait_list(struct task *task);
 
 /**
  * Run a new task
  *
- * Add a new task to the scheduler runqueue and returns its task id.
- * The new task will not preempt the current and will have to wait to be chosen
- * by the scheduler to be run.
+ * Add a new task to the scheduler runqueue with TASK_PRIORITY_DEFAULT and
+ * returns it. The new task will not preempt the current unless the current
+ * task has a lower priority.
  *
  * task: Pointer to the new task
  * data: data shared with the new task
@@ -68,15 +184,106 @@ void task_remove_from_wait_list(struct task *task);
  */
 struct task *task_run(task_entry_t task, void *data, uint32_t stack_addr);
 
+/**
+ * Run a new task with the given priority
+ *
+ * Same as task_run() but the task is added to the runqueue of priority
+ * `priority`. If it is higher than the priority of the running task, the new
+ * task preempts it.
+ *
+ * priority: between TASK_PRIORITY_IDLE + 1 and TASK_PRIORITY_MAX, higher
+ *           values are scheduled first
+ */
+struct task *task_run_priority(task_entry_t task, void *data,
+                               uint32_t stack_addr, int priority);
+
+/**
+ * Run a new task on a stack of the given size
+ *
+ * The task control block and the stack are taken from the task pools when
+ * CONFIG_TASK_POOL is enabled and a pool can provide them, and from the heap
+ * otherwise.
+ *
+ * stack_size: size of the stack in bytes
+ * priority: same as task_run_priority()
+ */
+struct task *task_run_with_stack(task_entry_t task, void *data,
+                                 size_t stack_size, int priority);
+
+/**
+ * Change the priority of a task
+ *
+ * The task is moved to the tail of the runqueue (or requeued in the wait list)
+ * matching its new priority, and the running task is preempted if it is no
+ * longer the highest priority runnable task.
+ */
+void task_set_priority(struct task *task, int priority);
+
+/**
+ * Change the effective priority of a task without changing its base priority
+ *
+ * Used by the mutexes to boost the priority of their owner. The task is
+ * requeued like with task_set_priority().
+ */
+void task_change_priority(struct task *task, int priority);
+
 /**
  * Get the task ID of the running task
  */
 struct task *task_get_running(void);
 
+/**
+ * Get a snapshot of the state and statistics of every task
+ *
+ * The runtime of the running task is accounted up to the call.
+ *
+ * info: array receiving the snapshot
+ * count: number of elements of the array
+ *
+ * Returns the number of tasks stored in info
+ */
+size_t task_get_info(struct task_info *info, size_t count);
+
+/*
+ * Timeout of a blocking call, pulls the task off its wait list on expiry.
+ * Lives on the stack of the waiting task, so arming it never allocates.
+ */
+struct task_timeout {
+    struct watchdog wd;
+    struct task *task;
+    bool expired;
+};
+
+/**
+ * Arm a timeout for the running task
+ *
+ * Once `usec` microseconds have elapsed, `expired` is set and the task is
+ * removed from the wait list it is blocked on, if any. Blocking loops must
+ * check `expired` before waiting again.
+ */
+void task_timeout_start(struct task_timeout *timeout, unsigned long usec);
+
+/**
+ * Disarm a timeout
+ *
+ * Returns true if the timeout expired
+ */
+bool task_timeout_stop(struct task_timeout *timeout);
+
 void sched_lock(void);
 void sched_unlock(void);
 
 void task_cond_wait(struct task_cond* cond, struct mutex *mutex);
+
+/**
+ * Same as task_cond_wait() but gives up after `usec` microseconds
+ *
+ * The mutex is locked again in both cases.
+ *
+ * Returns 0 if the condition has been signaled, -ETIMEDOUT otherwise
+ */
+int task_cond_timedwait(struct task_cond* cond, struct mutex *mutex,
+                        unsigned long usec);
 void task_cond_signal(struct task_cond* cond);
 void task_cond_broadcast(struct task_cond* cond);
 
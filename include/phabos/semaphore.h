@@ -17,9 +17,21 @@ struct semaphore {
     atomic_t count;
 };
 
+#define SEMAPHORE_INIT(x, val) { \
+    .wait_list = LIST_INIT((x).wait_list), \
+    .count = val, \
+}
+
 struct semaphore *semaphore_create(unsigned val);
 void semaphore_init(struct semaphore *semaphore, unsigned val);
 void semaphore_lock(struct semaphore *semaphore);
+
+/**
+ * Same as semaphore_lock() but gives up after `usec` microseconds
+ *
+ * Returns 0 if the semaphore has been taken, -ETIMEDOUT otherwise
+ */
+int semaphore_lock_timeout(struct semaphore *semaphore, unsigned long usec);
 bool semaphore_trylock(struct semaphore *semaphore);
 void semaphore_unlock(struct semaphore *semaphore);
 void semaphore_destroy(struct semaphore *semaphore);
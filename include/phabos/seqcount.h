@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __SEQCOUNT_H__
+#define __SEQCOUNT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <asm/barrier.h>
+
+/*
+ * Sequence counter used as a latch, like Linux's seqcount_latch: the data is
+ * kept in two copies, updated one after the other, and the count tells the
+ * readers which copy the writer is leaving alone (copy `sequence & 1`). A
+ * reader therefore never waits for a writer, not even one it interrupted. It
+ * only retries when a writer completed a step during its read, which cannot
+ * happen while it is interrupting that writer.
+ *
+ * Writers must be serialized. They call write_seqcount_latch(), update copy
+ * 0, call write_seqcount_latch() again and update copy 1.
+ */
+struct seqcount {
+    volatile uint32_t sequence;
+};
+
+#define SEQCOUNT_INIT { .sequence = 0 }
+
+/**
+ * Returns the count to pass to read_seqcount_latch_retry(), the copy to read
+ * is `count & 1`. An odd count means the reader interrupted a writer.
+ */
+static inline uint32_t read_seqcount_latch(struct seqcount *s)
+{
+    uint32_t seq = s->sequence;
+
+    dmb();
+    return seq;
+}
+
+/**
+ * Returns true if the copy read since read_seqcount_latch() may be torn
+ */
+static inline bool read_seqcount_latch_retry(struct seqcount *s, uint32_t seq)
+{
+    dmb();
+    return s->sequence != seq;
+}
+
+static inline void write_seqcount_latch(struct seqcount *s)
+{
+    dmb();
+    s->sequence++;
+    dmb();
+}
+
+#endif /* __SEQCOUNT_H__ */
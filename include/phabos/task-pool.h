@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __TASK_POOL_H__
+#define __TASK_POOL_H__
+
+#include <config.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+struct task;
+
+#ifdef CONFIG_TASK_POOL
+/**
+ * Build the free lists of the task control block and stack pools
+ *
+ * Must be called once, before any task is created.
+ */
+void task_pool_init(void);
+
+/**
+ * Get a zeroed task control block from the pool
+ *
+ * Returns NULL if the pool is exhausted.
+ */
+struct task *task_pool_alloc(void);
+
+/**
+ * Give a task control block back to the pool
+ *
+ * Returns false if the task control block does not belong to the pool.
+ */
+bool task_pool_free(struct task *task);
+
+/**
+ * Get a stack from the smallest stack pool fitting `size` bytes
+ *
+ * size: requested size of the stack, updated with the size of the stack
+ *       returned, which can be bigger than requested
+ *
+ * Returns NULL if no pool can provide such a stack.
+ */
+void *stack_pool_alloc(size_t *size);
+
+/**
+ * Give a stack back to its pool
+ *
+ * Returns false if the stack does not belong to any pool.
+ */
+bool stack_pool_free(void *stack);
+#else
+static inline void task_pool_init(void)
+{
+}
+
+static inline struct task *task_pool_alloc(void)
+{
+    return NULL;
+}
+
+static inline bool task_pool_free(struct task *task)
+{
+    return false;
+}
+
+static inline void *stack_pool_alloc(size_t *size)
+{
+    return NULL;
+}
+
+static inline bool stack_pool_free(void *stack)
+{
+    return false;
+}
+#endif
+
+#endif /* __TASK_POOL_H__ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2014-2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <config.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum trace_event {
+    TRACE_SWITCH,           /* arg: id of the next task */
+    TRACE_WAIT,             /* arg: id of the task put on a wait list */
+    TRACE_WAKEUP,           /* arg: id of the task woken up */
+    TRACE_IRQ_ENTER,        /* arg: exception number */
+    TRACE_IRQ_EXIT,         /* arg: exception number */
+    TRACE_SEM_BLOCK,        /* arg: address of the semaphore */
+    TRACE_SEM_UNBLOCK,      /* arg: address of the semaphore */
+};
+
+struct trace_entry {
+    uint32_t timestamp;     /* CPU cycles, truncated to 32 bits */
+    uint16_t event;
+    uint16_t task;          /* id of the running task */
+    uint32_t arg;
+};
+
+#ifdef CONFIG_TRACE
+
+extern bool trace_enabled;
+
+void __trace_record(enum trace_event event, uint32_t arg);
+
+/**
+ * Record an event in the trace ring
+ *
+ * Lock-free and safe to call from any context. Does nothing unless the trace
+ * has been started.
+ */
+static inline void trace_record(enum trace_event event, uint32_t arg)
+{
+    if (trace_enabled)
+        __trace_record(event, arg);
+}
+
+void trace_start(void);
+void trace_stop(void);
+
+#else
+
+static inline void trace_record(enum trace_event event, uint32_t arg) {}
+static inline void trace_start(void) {}
+static inline void trace_stop(void) {}
+
+#endif
+
+#endif /* __TRACE_H__ */
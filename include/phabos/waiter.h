@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __WAITER_H__
+#define __WAITER_H__
+
+#include <stdbool.h>
+#include <phabos/list.h>
+
+struct task;
+
+/*
+ * Record of a task sleeping on a synchronization object, lives on the stack
+ * of the task and is usually embedded in a larger record carrying what the
+ * object hands over on wake-up. The task sits alone on `wait_list` so that
+ * only the object can wake it up.
+ */
+struct waiter {
+    struct task *task;
+    bool done;
+    struct list_head list;
+    struct list_head wait_list;
+};
+
+/**
+ * Queue the running task on `waiters` and sleep until waiter_wake()
+ *
+ * The waiters are sorted by priority, FIFO among equal priorities.
+ *
+ * Must be called with the interrupts disabled, which are disabled again when
+ * it returns.
+ */
+void waiter_wait(struct list_head *waiters, struct waiter *waiter);
+
+/**
+ * Get the most urgent waiter of a list
+ *
+ * Returns NULL if nobody is waiting
+ */
+struct waiter *waiter_first(struct list_head *waiters);
+
+/**
+ * Remove a waiter from its list and wake its task up
+ *
+ * Must be called with the interrupts disabled
+ */
+void waiter_wake(struct waiter *waiter);
+
+#endif /* __WAITER_H__ */
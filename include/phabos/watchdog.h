@@ -8,17 +8,74 @@
 #ifndef __WATCHDOG_H__
 #define __WATCHDOG_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <phabos/list.h>
+
+/* Bookkeeping of the timer implementation, not to be touched by users */
+struct watchdog_node {
+    struct list_head list;
+    uint64_t end;
+    uint32_t slack;
+    uint16_t slot;
+};
+
+/*
+ * The timer node is embedded, so a watchdog lives wherever its user puts it
+ * and arming it never allocates.
+ */
 struct watchdog {
     void (*timeout)(struct watchdog *wd);
-    void *priv;
     void *user_priv;
+    struct watchdog_node node;
 };
 
 void watchdog_start(struct watchdog *wd, unsigned long timeout);
-void watchdog_cancel(struct watchdog *wd);
+
+/**
+ * Arm a watchdog to expire on an absolute tick
+ *
+ * A tick already in the past expires on the next one.
+ */
+void watchdog_start_at(struct watchdog *wd, uint64_t tick);
+
+/**
+ * Disarm a watchdog and wait for its callback if it is running
+ *
+ * Must be called with the interrupts enabled. The callback cannot be waited
+ * for from the watchdog callbacks themselves or from interrupt handlers.
+ *
+ * Returns true if the callback is still running, in which case the storage
+ * of the watchdog must not be reused yet. Otherwise the watchdog is neither
+ * armed, queued nor running and its storage can be reused.
+ */
+bool watchdog_cancel(struct watchdog *wd);
 void watchdog_init(struct watchdog *wd);
-void watchdog_delete(struct watchdog *wd);
+
+/**
+ * Allow a watchdog to expire up to `usec` microseconds late
+ *
+ * The deadline is then moved to a tick within that window on which another
+ * watchdog already expires, or else to the roundest one, so that watchdogs
+ * with overlapping windows expire together and wake the system once. The
+ * slack is rounded up to whole ticks. Watchdogs have no slack by default,
+ * the new value applies from the next time the watchdog is armed.
+ */
+void watchdog_set_slack(struct watchdog *wd, unsigned long usec);
 bool watchdog_has_expired(struct watchdog *wd);
 
+/**
+ * Get the tick of the earliest armed watchdog expiry
+ *
+ * Returns UINT64_MAX if no watchdog is armed.
+ */
+uint64_t watchdog_next_expiry(void);
+
+/**
+ * Get the cycles spent processing the watchdogs from the tick handler, and
+ * the number of times it ran. Only available with CONFIG_BENCH.
+ */
+void watchdog_get_tick_stats(uint32_t *cycles, uint32_t *count);
+
 #endif /* __WATCHDOG_H__ */
 
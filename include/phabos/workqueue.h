@@ -8,10 +8,12 @@
 #ifndef __WORKQUEUE_H__
 #define __WORKQUEUE_H__
 
+#include <config.h>
 #include <asm/spinlock.h>
 #include <phabos/semaphore.h>
 #include <phabos/list.h>
 #include <phabos/watchdog.h>
+#include <phabos/hrtimer.h>
 
 typedef void (*work_entry_t)(void *data);
 
@@ -30,7 +32,11 @@ struct work {
     void *data;
     bool is_schedulable;
 
+#ifdef CONFIG_HRTIMER
+    struct hrtimer timer;
+#else
     struct watchdog watchdog;
+#endif
     struct workqueue *wq;
     struct list_head list;
 };
@@ -38,6 +44,14 @@ struct work {
 struct workqueue *workqueue_create(const char *name);
 void workqueue_destroy(struct workqueue *wq);
 void workqueue_queue(struct workqueue *wq, work_entry_t callback, void *data);
+
+/**
+ * Run `callback` from the workqueue after `delay` microseconds
+ *
+ * The delay is a lower bound: the work can run up to 1/256th of the delay
+ * later, so that delayed works due around the same time wake the system
+ * once.
+ */
 void workqueue_schedule(struct workqueue *wq, work_entry_t callback,
                         void *data, uint32_t delay);
 bool workqueue_has_pending_work(struct workqueue *wq);
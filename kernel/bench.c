@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2014-2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <config.h>
+#include <phabos/shell.h>
+#include <phabos/scheduler.h>
+#include <phabos/semaphore.h>
+#include <phabos/sleep.h>
+#include <phabos/watchdog.h>
+#include <phabos/utils.h>
+#include <asm/machine.h>
+#include <asm/semihosting.h>
+
+/*
+ * Results are printed as:
+ *   BENCH <name> <iterations> <total cycles> <cycles per iteration>
+ * followed by a single "BENCH END <status>" line.
+ */
+
+#define BENCH_PRIORITY          (TASK_PRIORITY_MAX - 1)
+#define BENCH_ITERATIONS        1000
+#define BENCH_TASK_ITERATIONS   100
+#define BENCH_USLEEP_ITERATIONS 10
+#define BENCH_USLEEP_USEC       1000
+#define BENCH_WATCHDOG_COUNT    256
+#define BENCH_WATCHDOG_SPREAD   (HZ * 3 / 4)
+#define BENCH_WATCHDOG_LATENESS 2
+
+#define xstr(s) str(s)
+#define str(s) #s
+
+struct bench {
+    const char *name;
+    unsigned iterations;
+    int (*run)(unsigned iterations, uint32_t *cycles);
+};
+
+static struct semaphore bench_done;
+static struct semaphore bench_ping;
+static struct semaphore bench_pong;
+static unsigned bench_count;
+
+static void bench_yield_task(void *data)
+{
+    for (unsigned i = 0; i < bench_count; i++)
+        task_yield();
+    semaphore_unlock(&bench_done);
+}
+
+static void bench_ping_task(void *data)
+{
+    for (unsigned i = 0; i < bench_count; i++) {
+        semaphore_unlock(&bench_ping);
+        semaphore_lock(&bench_pong);
+    }
+    semaphore_unlock(&bench_done);
+}
+
+static void bench_pong_task(void *data)
+{
+    for (unsigned i = 0; i < bench_count; i++) {
+        semaphore_lock(&bench_ping);
+        semaphore_unlock(&bench_pong);
+    }
+    semaphore_unlock(&bench_done);
+}
+
+static void bench_idle_task(void *data)
+{
+}
+
+/*
+ * The shell task runs at BENCH_PRIORITY during the benchmarks, so tasks it
+ * creates at the same priority only start once it blocks.
+ */
+static int bench_run_pair(task_entry_t entry1, task_entry_t entry2,
+                          unsigned iterations, uint32_t *cycles)
+{
+    struct task *task;
+    uint64_t start;
+
+    bench_count = iterations;
+    semaphore_init(&bench_done, 0);
+    semaphore_init(&bench_ping, 0);
+    semaphore_init(&bench_pong, 0);
+
+    task = task_run_priority(entry1, NULL, 0, BENCH_PRIORITY);
+    if (!task)
+        return -1;
+    if (!task_run_priority(entry2, NULL, 0, BENCH_PRIORITY)) {
+        task_kill(task);
+        task_reap_zombies();
+        return -1;
+    }
+
+    start = get_cycles();
+    semaphore_lock(&bench_done);
+    semaphore_lock(&bench_done);
+    *cycles = get_cycles() - start;
+
+    task_reap_zombies();
+    return 0;
+}
+
+static int bench_yield(unsigned iterations, uint32_t *cycles)
+{
+    uint64_t start = get_cycles();
+
+    for (unsigned i = 0; i < iterations; i++)
+        task_yield();
+
+    *cycles = get_cycles() - start;
+    return 0;
+}
+
+static int bench_context_switch(unsigned iterations, uint32_t *cycles)
+{
+    /* each yield of the two tasks is a switch */
+    return bench_run_pair(bench_yield_task, bench_yield_task, iterations / 2,
+                          cycles);
+}
+
+static int bench_semaphore(unsigned iterations, uint32_t *cycles)
+{
+    return bench_run_pair(bench_ping_task, bench_pong_task, iterations,
+                          cycles);
+}
+
+static int bench_task_run_kill(unsigned iterations, uint32_t *cycles)
+{
+    struct task *task;
+    uint64_t start = get_cycles();
+
+    for (unsigned i = 0; i < iterations; i++) {
+        task = task_run_priority(bench_idle_task, NULL, 0,
+                                 TASK_PRIORITY_IDLE + 1);
+        if (!task)
+            return -1;
+        task_kill(task);
+    }
+
+    *cycles = get_cycles() - start;
+    task_reap_zombies();
+    return 0;
+}
+
+/* Reports the wake-up latency: time slept beyond the requested delay */
+static int bench_usleep(unsigned iterations, uint32_t *cycles)
+{
+    const uint32_t expected = BENCH_USLEEP_USEC * (CPU_FREQ / 1000000);
+    uint32_t elapsed;
+    uint64_t start;
+
+    *cycles = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        start = get_cycles();
+        usleep(BENCH_USLEEP_USEC);
+        elapsed = get_cycles() - start;
+
+        if (elapsed < expected) {
+            printf("bench: usleep woke up %u cycles early\n",
+                   (unsigned) (expected - elapsed));
+            return -1;
+        }
+        *cycles += elapsed - expected;
+    }
+
+    return 0;
+}
+
+#ifdef CONFIG_SCHEDULER_WATCHDOG
+struct bench_watchdog {
+    struct watchdog wd;
+    uint64_t deadline;
+    uint64_t fired;
+};
+
+static void bench_watchdog_timeout(struct watchdog *wd)
+{
+    struct bench_watchdog *bwd = wd->user_priv;
+
+    bwd->fired = get_ticks();
+}
+
+/*
+ * Average cost of the watchdog processing of a tick over one second, with
+ * `count` watchdogs expiring during that second.
+ *
+ * The deadlines are spread over the first BENCH_WATCHDOG_SPREAD ticks, so
+ * that the watchdogs are armed on the first two levels of the wheel and
+ * those of level 1 cascade down to level 0 before expiring. Each one must
+ * expire on its tick, give or take the scheduling of the watchdog task.
+ */
+static int bench_watchdog_tick(unsigned count, unsigned iterations,
+                               uint32_t *cycles)
+{
+    struct bench_watchdog *bwd;
+    uint32_t start_cycles;
+    uint32_t start_count;
+    uint32_t end_cycles;
+    uint32_t end_count;
+    unsigned missed = 0;
+    uint64_t now;
+
+    bwd = calloc(count ? count : 1, sizeof(*bwd));
+    if (!bwd)
+        return -1;
+
+    tickless_exit();
+    now = get_ticks();
+
+    for (unsigned i = 0; i < count; i++) {
+        watchdog_init(&bwd[i].wd);
+        bwd[i].wd.timeout = bench_watchdog_timeout;
+        bwd[i].wd.user_priv = &bwd[i];
+        bwd[i].deadline = now + 1 + i * BENCH_WATCHDOG_SPREAD / count;
+        watchdog_start_at(&bwd[i].wd, bwd[i].deadline);
+    }
+
+    watchdog_get_tick_stats(&start_cycles, &start_count);
+    usleep(1000000);
+    watchdog_get_tick_stats(&end_cycles, &end_count);
+
+    for (unsigned i = 0; i < count; i++) {
+        watchdog_cancel(&bwd[i].wd);
+        if (bwd[i].fired < bwd[i].deadline ||
+            bwd[i].fired > bwd[i].deadline + BENCH_WATCHDOG_LATENESS)
+            missed++;
+    }
+    free(bwd);
+
+    if (missed) {
+        printf("bench: %u watchdogs did not expire on time\n", missed);
+        return -1;
+    }
+
+    if (end_count == start_count)
+        return -1;
+
+    *cycles = (end_cycles - start_cycles) / (end_count - start_count) *
+              iterations;
+    return 0;
+}
+
+static int bench_watchdog_tick_empty(unsigned iterations, uint32_t *cycles)
+{
+    return bench_watchdog_tick(0, iterations, cycles);
+}
+
+static int bench_watchdog_tick_loaded(unsigned iterations, uint32_t *cycles)
+{
+    return bench_watchdog_tick(BENCH_WATCHDOG_COUNT, iterations, cycles);
+}
+#endif
+
+static const struct bench benchmarks[] = {
+    {"yield", BENCH_ITERATIONS, bench_yield},
+    {"context_switch", BENCH_ITERATIONS, bench_context_switch},
+    {"semaphore_pingpong", BENCH_ITERATIONS, bench_semaphore},
+    {"task_run_kill", BENCH_TASK_ITERATIONS, bench_task_run_kill},
+    {"usleep_1ms_latency", BENCH_USLEEP_ITERATIONS, bench_usleep},
+#ifdef CONFIG_SCHEDULER_WATCHDOG
+    {"watchdog_tick_0", HZ, bench_watchdog_tick_empty},
+    {"watchdog_tick_" xstr(BENCH_WATCHDOG_COUNT), HZ,
+     bench_watchdog_tick_loaded},
+#endif
+};
+
+static int bench_main(int argc, char **argv)
+{
+    struct task *task = task_get_running();
+    int priority = task->base_priority;
+    const struct bench *bench;
+    uint32_t cycles;
+    int status = 0;
+
+    task_set_priority(task, BENCH_PRIORITY);
+
+    for (int i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        bench = &benchmarks[i];
+
+        if (bench->run(bench->iterations, &cycles)) {
+            printf("BENCH %s FAILED\n", bench->name);
+            status = 1;
+            continue;
+        }
+
+        printf("BENCH %s %u %u %u\n", bench->name, bench->iterations,
+               (unsigned) cycles, (unsigned) cycles / bench->iterations);
+    }
+
+    task_set_priority(task, priority);
+
+    printf("BENCH END %d\n", status);
+
+#ifdef CONFIG_ARM_SEMIHOSTING
+    if (argc > 1 && !strcmp(argv[1], "exit"))
+        semihosting_exit(status);
+#endif
+
+    return status;
+}
+
+__shell_command__ struct shell_command bench_commands[] = {
+    {"bench", "[exit]", bench_main},
+};
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include <config.h>
+#include <phabos/event-task.h>
+#include <phabos/scheduler.h>
+#include <phabos/semaphore.h>
+#include <phabos/assert.h>
+#include <asm/irq.h>
+
+static struct list_head event_task_queue = LIST_INIT(event_task_queue);
+static struct semaphore event_task_semaphore =
+    SEMAPHORE_INIT(event_task_semaphore, 0);
+
+void event_task_init(struct event_task *et, event_task_entry_t entry,
+                     void *data)
+{
+    RET_IF_FAIL(et,);
+
+    memset(et, 0, sizeof(*et));
+    et->entry = entry;
+    et->data = data;
+    list_init(&et->list);
+}
+
+void event_task_post(struct event_task *et)
+{
+    RET_IF_FAIL(et,);
+
+    irq_disable();
+    if (!et->queued) {
+        et->queued = true;
+        list_add(&event_task_queue, &et->list);
+        semaphore_unlock(&event_task_semaphore);
+    }
+    irq_enable();
+}
+
+/*
+ * Each pending event task takes one count of the semaphore. An event task is
+ * dequeued before being run so that a post made while it runs is not lost.
+ */
+static void event_task_dispatcher(void *data)
+{
+    struct event_task *et;
+
+    while (1) {
+        semaphore_lock(&event_task_semaphore);
+
+        irq_disable();
+        et = list_first_entry(&event_task_queue, struct event_task, list);
+        list_del(&et->list);
+        et->queued = false;
+        irq_enable();
+
+        if (et->entry(et) == ET_YIELDED)
+            event_task_post(et);
+    }
+}
+
+DEFINE_TASK(event_task, event_task_dispatcher, CONFIG_EVENT_TASK_STACK_SIZE,
+            CONFIG_EVENT_TASK_PRIORITY);
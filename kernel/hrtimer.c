@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include <phabos/hrtimer.h>
+#include <phabos/assert.h>
+#include <asm/scheduler.h>
+#include <asm/machine.h>
+#include <asm/irq.h>
+
+#define CYCLES_PER_USEC (CPU_FREQ / 1000000)
+
+/* pending timers, sorted by latest deadline */
+static struct list_head hrtimer_list = LIST_INIT(hrtimer_list);
+
+static uint64_t hrtimer_latest(struct hrtimer *timer)
+{
+    return timer->expires + timer->slack;
+}
+
+/* Must be called with the interrupts disabled */
+static void hrtimer_program_next(void)
+{
+    struct hrtimer *first;
+    uint64_t now;
+    uint64_t delta;
+
+    if (list_is_empty(&hrtimer_list)) {
+        machine_hrtimer_stop();
+        return;
+    }
+
+    first = list_first_entry(&hrtimer_list, struct hrtimer, list);
+    now = get_cycles();
+
+    delta = hrtimer_latest(first) > now ? hrtimer_latest(first) - now : 1;
+    if (delta > UINT32_MAX)
+        delta = UINT32_MAX;
+
+    machine_hrtimer_program(delta);
+}
+
+void hrtimers_init(void)
+{
+    machine_hrtimer_init();
+}
+
+void hrtimer_init(struct hrtimer *timer, void (*callback)(struct hrtimer*),
+                  void *data)
+{
+    RET_IF_FAIL(timer,);
+
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->data = data;
+    list_init(&timer->list);
+}
+
+void hrtimer_start(struct hrtimer *timer, unsigned long usec)
+{
+    struct list_head *iter;
+    struct hrtimer *t;
+
+    RET_IF_FAIL(timer,);
+    RET_IF_FAIL(timer->callback,);
+
+    irq_disable();
+
+    if (!list_is_empty(&timer->list))
+        list_del(&timer->list);
+
+    timer->expires = get_cycles() + (uint64_t) usec * CYCLES_PER_USEC;
+
+    for (iter = hrtimer_list.next; iter != &hrtimer_list; iter = iter->next) {
+        t = list_entry(iter, struct hrtimer, list);
+        if (hrtimer_latest(t) > hrtimer_latest(timer))
+            break;
+    }
+    list_add(iter, &timer->list);
+
+    if (hrtimer_list.next == &timer->list)
+        hrtimer_program_next();
+
+    irq_enable();
+}
+
+void hrtimer_cancel(struct hrtimer *timer)
+{
+    bool was_first;
+
+    RET_IF_FAIL(timer,);
+
+    irq_disable();
+
+    if (!list_is_empty(&timer->list)) {
+        was_first = hrtimer_list.next == &timer->list;
+        list_del(&timer->list);
+        if (was_first)
+            hrtimer_program_next();
+    }
+
+    irq_enable();
+}
+
+void hrtimer_set_slack(struct hrtimer *timer, unsigned long usec)
+{
+    uint64_t slack = (uint64_t) usec * CYCLES_PER_USEC;
+
+    RET_IF_FAIL(timer,);
+
+    timer->slack = slack > UINT32_MAX ? UINT32_MAX : slack;
+}
+
+bool hrtimer_is_pending(struct hrtimer *timer)
+{
+    return !list_is_empty(&timer->list);
+}
+
+void hrtimer_interrupt(void)
+{
+    struct hrtimer *timer;
+
+    irq_disable();
+
+    while (!list_is_empty(&hrtimer_list)) {
+        timer = list_first_entry(&hrtimer_list, struct hrtimer, list);
+
+        /* the next timers in line go too if their slack window is open */
+        if (timer->expires > get_cycles())
+            break;
+
+        list_del(&timer->list);
+
+        irq_enable();
+        timer->callback(timer);
+        irq_disable();
+    }
+
+    hrtimer_program_next();
+
+    irq_enable();
+}
@@ -10,6 +10,7 @@
 #include <phabos/kprintf.h>
 #include <phabos/scheduler.h>
 #include <phabos/syscall.h>
+#include <phabos/hrtimer.h>
 
 int CONFIG_INIT_TASK_NAME(int argc, char **argv);
 
@@ -22,11 +23,13 @@ void init(void *data)
         xstr(CONFIG_INIT_TASK_NAME),
         NULL
     };
-    CONFIG_INIT_TASK_NAME(1, argv);
 
-    while (1);
+    task_reent_init();
+    CONFIG_INIT_TASK_NAME(1, argv);
 }
 
+DEFINE_TASK(init, init, CONFIG_INIT_TASK_STACK_SIZE, TASK_PRIORITY_DEFAULT);
+
 static void clear_screen(void)
 {
     kprintf("\r%c[2J",27);
@@ -38,6 +41,11 @@ void main(void)
     kprintf("booting phabos...\n");
 
     syscall_init();
+#ifdef CONFIG_HRTIMER
+    hrtimers_init();
+#endif
     scheduler_init();
-    task_run(init, NULL, 0);
+
+    /* From here, we are the idle task */
+    scheduler_idle();
 }
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <config.h>
+#include <phabos/periodic-timer.h>
+#include <phabos/shell.h>
+#include <phabos/div64.h>
+#include <phabos/assert.h>
+#include <asm/scheduler.h>
+#include <asm/machine.h>
+#include <asm/irq.h>
+
+#define USEC_PER_TICK   (1000000 / HZ)
+#define CYCLES_PER_TICK (CPU_FREQ / HZ)
+#define CYCLES_PER_USEC (CPU_FREQ / 1000000)
+
+/* running timers, for the shell */
+static struct list_head periodic_timers = LIST_INIT(periodic_timers);
+
+static int timers_main(int argc, char **argv);
+
+__shell_command__ struct shell_command periodic_timer_commands[] = {
+    {"timers", "list the periodic timers and their jitter", timers_main},
+};
+
+static uint32_t periodic_timer_jitter(struct periodic_timer *timer)
+{
+    uint64_t due = timer->deadline * CYCLES_PER_TICK;
+    uint64_t now = get_cycles();
+    uint64_t delta = now > due ? now - due : 0;
+
+    if (delta > UINT32_MAX)
+        delta = UINT32_MAX;
+
+    return (uint32_t) delta / CYCLES_PER_USEC;
+}
+
+/*
+ * The timer is re-armed before its callback runs, so that the callback can
+ * stop it, and take as long as it wants without delaying the next deadline.
+ */
+static void periodic_timer_expired(struct watchdog *wd)
+{
+    struct periodic_timer *timer = wd->user_priv;
+    uint32_t jitter;
+    uint32_t missed;
+    uint64_t ticks;
+
+    irq_disable();
+
+    if (!timer->period) {
+        irq_enable();
+        return;
+    }
+
+    jitter = periodic_timer_jitter(timer);
+    if (!timer->runs || jitter < timer->jitter_min)
+        timer->jitter_min = jitter;
+    if (jitter > timer->jitter_max)
+        timer->jitter_max = jitter;
+    timer->runs++;
+
+    /* both halved when the count saturates, so that the mean stays right */
+    if (timer->jitter_samples == UINT32_MAX) {
+        timer->jitter_sum >>= 1;
+        timer->jitter_samples >>= 1;
+    }
+    timer->jitter_sum += jitter;
+    timer->jitter_samples++;
+
+    ticks = get_ticks();
+    timer->deadline += timer->period;
+    if (timer->deadline <= ticks) {
+        missed = (uint32_t) (ticks - timer->deadline) / timer->period + 1;
+        timer->deadline += (uint64_t) missed * timer->period;
+        timer->overruns += missed;
+    }
+
+    watchdog_start_at(&timer->wd, timer->deadline);
+
+    irq_enable();
+
+    if (timer->callback)
+        timer->callback(timer);
+}
+
+void periodic_timer_init(struct periodic_timer *timer, const char *name,
+                         void (*callback)(struct periodic_timer*), void *data)
+{
+    RET_IF_FAIL(timer,);
+
+    memset(timer, 0, sizeof(*timer));
+    timer->name = name;
+    timer->callback = callback;
+    timer->data = data;
+    list_init(&timer->list);
+
+    watchdog_init(&timer->wd);
+    timer->wd.timeout = periodic_timer_expired;
+    timer->wd.user_priv = timer;
+}
+
+void periodic_timer_start(struct periodic_timer *timer, unsigned long usec)
+{
+    RET_IF_FAIL(timer,);
+    RET_IF_FAIL(usec > 0,);
+
+    tickless_exit();
+
+    irq_disable();
+
+    timer->period = (usec + USEC_PER_TICK - 1) / USEC_PER_TICK;
+    timer->deadline = get_ticks() + timer->period;
+    timer->runs = 0;
+    timer->overruns = 0;
+    timer->jitter_min = 0;
+    timer->jitter_max = 0;
+    timer->jitter_sum = 0;
+    timer->jitter_samples = 0;
+
+    if (list_is_empty(&timer->list))
+        list_add(&periodic_timers, &timer->list);
+
+    watchdog_start_at(&timer->wd, timer->deadline);
+
+    irq_enable();
+}
+
+void periodic_timer_stop(struct periodic_timer *timer)
+{
+    RET_IF_FAIL(timer,);
+
+    irq_disable();
+    timer->period = 0;
+    list_del(&timer->list);
+    irq_enable();
+
+    /* outside of the critical section, so that it can wait for the callback */
+    watchdog_cancel(&timer->wd);
+}
+
+/*
+ * Timers can be stopped while printing, so the list is walked again for
+ * each entry instead of holding on to a node.
+ */
+static bool periodic_timer_get(unsigned index, struct periodic_timer *copy)
+{
+    bool found = false;
+
+    irq_disable();
+
+    list_foreach(&periodic_timers, iter) {
+        if (index--)
+            continue;
+
+        memcpy(copy, list_entry(iter, struct periodic_timer, list),
+               sizeof(*copy));
+        found = true;
+        break;
+    }
+
+    irq_enable();
+
+    return found;
+}
+
+static int timers_main(int argc, char **argv)
+{
+    struct periodic_timer timer;
+    uint32_t mean;
+    uint32_t rem;
+
+    printf("%-16s %10s %10s %8s %8s %8s %8s\n", "NAME", "PERIOD(us)", "RUNS",
+           "OVERRUNS", "MIN(us)", "MAX(us)", "MEAN(us)");
+
+    for (unsigned i = 0; periodic_timer_get(i, &timer); i++) {
+        mean = 0;
+        if (timer.jitter_samples)
+            mean = div_u64_rem(timer.jitter_sum, timer.jitter_samples, &rem);
+
+        printf("%-16s %10u %10u %8u %8u %8u %8u\n",
+               timer.name ? timer.name : "?",
+               (unsigned) (timer.period * USEC_PER_TICK), (unsigned) timer.runs,
+               (unsigned) timer.overruns, (unsigned) timer.jitter_min,
+               (unsigned) timer.jitter_max,
+               (unsigned) mean);
+    }
+
+    return 0;
+}
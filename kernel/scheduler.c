@@ -12,52 +12,199 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <reent.h>
 
 #include <phabos/scheduler.h>
 #include <phabos/utils.h>
 #include <phabos/assert.h>
 #include <phabos/panic.h>
+#include <phabos/task-pool.h>
+#include <phabos/trace.h>
 #include <asm/scheduler.h>
 #include <asm/irq.h>
 #include <asm/atomic.h>
+#include <asm/bitops.h>
 
 #define TASK_RUNNING                    (1 << 1)
+#define TASK_STATIC                     (1 << 2)
 #define DEFAULT_STACK_SIZE              4096
 
-static struct list_head runqueue = LIST_INIT(runqueue);
+/*
+ * One runqueue per priority level. Bit N of runqueue_bitmap is set when
+ * runqueue[N] is not empty, so the highest priority runnable task is found
+ * with a single CLZ whatever the number of tasks.
+ */
+static struct list_head runqueue[TASK_PRIORITY_COUNT];
+static uint32_t runqueue_bitmap;
+static struct list_head task_list = LIST_INIT(task_list);
+static struct list_head zombie_list = LIST_INIT(zombie_list);
+static struct list_head idle_hooks = LIST_INIT(idle_hooks);
+static uint64_t idle_cycles;
+static struct task idle_task;
 struct task *current;
 bool need_resched;
 static bool kill_task;
 static atomic_t is_locked;
 static int next_task_id;
+#ifdef CONFIG_TASK_STATS
+static uint64_t switch_timestamp;
+#endif
+
+static void task_init(struct task *task)
+{
+    list_init(&task->list);
+    list_init(&task->held_mutexes);
+
+    irq_disable();
+    task->id = next_task_id++;
+    list_add(&task_list, &task->all);
+    irq_enable();
+}
 
 static struct task *task_create(void)
 {
     struct task *task;
 
-    task = zalloc(sizeof(*task));
+    task = task_pool_alloc();
+    if (!task)
+        task = zalloc(sizeof(*task));
     RET_IF_FAIL(task, NULL);
 
-    list_init(&task->list);
+    task_init(task);
+
+    return task;
+}
+
+/* Must be called with the interrupts disabled */
+static void runqueue_add(struct task *task)
+{
+    list_add(&runqueue[task->priority], &task->list);
+    runqueue_bitmap |= 1u << task->priority;
+    task->state |= TASK_RUNNING;
+}
+
+/* Must be called with the interrupts disabled */
+static void runqueue_del(struct task *task)
+{
+    list_del(&task->list);
+    if (list_is_empty(&runqueue[task->priority]))
+        runqueue_bitmap &= ~(1u << task->priority);
+    task->state &= ~TASK_RUNNING;
+}
+
+/* Must be called with the interrupts disabled */
+static struct task *runqueue_pick(void)
+{
+    int priority = TASK_PRIORITY_MAX - clz(runqueue_bitmap);
+    return list_first_entry(&runqueue[priority], struct task, list);
+}
+
+/*
+ * Wait lists are kept sorted by priority, FIFO among tasks of equal priority,
+ * so that waking up the first waiter always wakes the most urgent one.
+ *
+ * Must be called with the interrupts disabled
+ */
+static void wait_list_add(struct list_head *wait_list, struct task *task)
+{
+    struct list_head *iter;
+    struct task *waiter;
+
+    for (iter = wait_list->next; iter != wait_list; iter = iter->next) {
+        waiter = list_entry(iter, struct task, list);
+        if (waiter->priority < task->priority)
+            break;
+    }
+
+    list_add(iter, &task->list);
+    task->wait_list = wait_list;
+}
+
+/*
+ * Request a reschedule if the running task is no longer the highest priority
+ * runnable task.
+ *
+ * Must be called with the interrupts disabled
+ */
+static void sched_check_preempt(void)
+{
+    if (!current || !runqueue_bitmap)
+        return;
+
+    if (runqueue_pick()->priority > current->priority)
+        task_yield();
+}
+
+static void task_timeout_expired(struct watchdog *wd)
+{
+    struct task_timeout *timeout = wd->user_priv;
 
     irq_disable();
-    task->id = next_task_id++;
+    timeout->expired = true;
+    if (timeout->task->wait_list)
+        task_remove_from_wait_list(timeout->task);
     irq_enable();
+}
 
-    return task;
+void task_timeout_start(struct task_timeout *timeout, unsigned long usec)
+{
+    watchdog_init(&timeout->wd);
+    timeout->wd.timeout = task_timeout_expired;
+    timeout->wd.user_priv = timeout;
+    timeout->task = task_get_running();
+    timeout->expired = false;
+
+    watchdog_start(&timeout->wd, usec);
+}
+
+bool task_timeout_stop(struct task_timeout *timeout)
+{
+    watchdog_cancel(&timeout->wd);
+    return timeout->expired;
 }
 
+/*
+ * The task goes on the wait list before releasing the mutex so that a signal
+ * sent right after the unlock cannot be lost.
+ */
 void task_cond_wait(struct task_cond* cond, struct mutex *mutex)
 {
+    irq_disable();
+    task_add_to_wait_list(task_get_running(), &cond->wait_list);
     mutex_unlock(mutex);
+    irq_enable();
+
+    task_yield();
+    mutex_lock(mutex);
+}
+
+int task_cond_timedwait(struct task_cond* cond, struct mutex *mutex,
+                        unsigned long usec)
+{
+    struct task_timeout timeout;
+    bool expired;
+
+    irq_disable();
     task_add_to_wait_list(task_get_running(), &cond->wait_list);
+    task_timeout_start(&timeout, usec);
+    mutex_unlock(mutex);
+    irq_enable();
+
+    task_yield();
+
+    expired = task_timeout_stop(&timeout);
     mutex_lock(mutex);
+
+    return expired ? -ETIMEDOUT : 0;
 }
 
 void task_cond_signal(struct task_cond* cond)
 {
-    task_remove_from_wait_list(list_first_entry(&cond->wait_list,
-                                                struct task, list));
+    irq_disable();
+    if (!list_is_empty(&cond->wait_list))
+        task_remove_from_wait_list(list_first_entry(&cond->wait_list,
+                                                    struct task, list));
+    irq_enable();
 }
 
 void task_cond_broadcast(struct task_cond* cond)
@@ -66,12 +213,31 @@ void task_cond_broadcast(struct task_cond* cond)
         task_remove_from_wait_list(list_entry(iter, struct task, list));
 }
 
+/*
+ * Dead tasks are only queued here: releasing their memory is left to
+ * task_reap_zombies() so that no allocator work happens in the context switch
+ * path. Must be called with interrupts disabled.
+ */
+static void task_zombify(struct task *task)
+{
+    list_del(&task->all);
+    list_add(&zombie_list, &task->list);
+}
+
 static void task_destroy(struct task *task)
 {
-    // assert
-    if (task->allocated_stack)
+    if (task->reent != _global_impure_ptr) {
+        _reclaim_reent(task->reent);
+        free(task->reent);
+    }
+
+    if (task->state & TASK_STATIC)
+        return;
+
+    if (task->allocated_stack && !stack_pool_free(task->allocated_stack))
         free(task->allocated_stack);
-    free(task);
+    if (!task_pool_free(task))
+        free(task);
 }
 
 struct task *task_get_running(void)
@@ -86,9 +252,12 @@ void task_add_to_wait_list(struct task *task, struct list_head *wait_list)
     if (task->id == 0)
         panic("PANIC: Trying to remove idle task from runqueue\n");
 
-    list_del(&task->list);
-    list_add(wait_list, &task->list);
-    task->state &= ~TASK_RUNNING;
+    if (task->state & TASK_RUNNING)
+        runqueue_del(task);
+    else
+        list_del(&task->list);
+    wait_list_add(wait_list, task);
+    trace_record(TRACE_WAIT, task->id);
 
     irq_enable();
 }
@@ -97,38 +266,122 @@ void task_remove_from_wait_list(struct task *task)
 {
     irq_disable();
 
+    if (task->state & TASK_RUNNING) {
+        irq_enable();
+        return;
+    }
+
     list_del(&task->list);
-    list_add(&runqueue, &task->list);
-    task->state |= TASK_RUNNING;
+    task->wait_list = NULL;
+    runqueue_add(task);
+    trace_record(TRACE_WAKEUP, task->id);
+    sched_check_preempt();
 
     irq_enable();
 }
 
-struct task *task_run(task_entry_t entry, void *data, uint32_t stack_addr)
+void task_set_priority(struct task *task, int priority)
 {
-    struct task *task = task_create();
-    if (!task)
-        return NULL;
+    RET_IF_FAIL(task,);
+    RET_IF_FAIL(task->id != 0,);
+    RET_IF_FAIL(priority > TASK_PRIORITY_IDLE,);
+    RET_IF_FAIL(priority <= TASK_PRIORITY_MAX,);
 
-    if (!stack_addr) {
-        task->allocated_stack = malloc(DEFAULT_STACK_SIZE);
-        if (!task->allocated_stack)
-            goto error_stack;
+    irq_disable();
+    task->base_priority = priority;
+    task_change_priority(task, mutex_inherited_priority(task));
+    irq_enable();
+}
+
+void task_change_priority(struct task *task, int priority)
+{
+    irq_disable();
 
-        stack_addr = (uint32_t) task->allocated_stack + DEFAULT_STACK_SIZE;
+    if (task->priority == priority) {
+        irq_enable();
+        return;
+    }
+
+    if (task->state & TASK_RUNNING) {
+        runqueue_del(task);
+        task->priority = priority;
+        runqueue_add(task);
+    } else if (task->wait_list) {
+        list_del(&task->list);
+        task->priority = priority;
+        wait_list_add(task->wait_list, task);
+    } else {
+        task->priority = priority;
     }
 
+    sched_check_preempt();
+
+    irq_enable();
+}
+
+struct task *task_run(task_entry_t entry, void *data, uint32_t stack_addr)
+{
+    return task_run_priority(entry, data, stack_addr, TASK_PRIORITY_DEFAULT);
+}
+
+static struct task *task_start(task_entry_t entry, void *data,
+                               uint32_t stack_addr, void *allocated_stack,
+                               int priority)
+{
+    struct task *task;
+
+    task = task_create();
+    if (!task)
+        return NULL;
+
+    task->allocated_stack = allocated_stack;
     task_init_registers(task, entry, data, stack_addr);
-    task->state = TASK_RUNNING;
+    task->priority = task->base_priority = priority;
 
     irq_disable();
-    list_add(&runqueue, &task->list);
+    runqueue_add(task);
+    sched_check_preempt();
     irq_enable();
 
     return task;
-error_stack:
-    free(task);
-    return NULL;
+}
+
+struct task *task_run_priority(task_entry_t entry, void *data,
+                               uint32_t stack_addr, int priority)
+{
+    RET_IF_FAIL(priority > TASK_PRIORITY_IDLE, NULL);
+    RET_IF_FAIL(priority <= TASK_PRIORITY_MAX, NULL);
+
+    if (!stack_addr)
+        return task_run_with_stack(entry, data, DEFAULT_STACK_SIZE, priority);
+
+    return task_start(entry, data, stack_addr, NULL, priority);
+}
+
+struct task *task_run_with_stack(task_entry_t entry, void *data,
+                                 size_t stack_size, int priority)
+{
+    struct task *task;
+    void *stack;
+
+    RET_IF_FAIL(stack_size >= TASK_STACK_MIN, NULL);
+    RET_IF_FAIL(priority > TASK_PRIORITY_IDLE, NULL);
+    RET_IF_FAIL(priority <= TASK_PRIORITY_MAX, NULL);
+
+    stack_size = (stack_size + 7) & ~7;
+
+    stack = stack_pool_alloc(&stack_size);
+    if (!stack)
+        stack = malloc(stack_size);
+    if (!stack)
+        return NULL;
+
+    task = task_start(entry, data, (uint32_t) stack + stack_size, stack,
+                      priority);
+    if (!task && !stack_pool_free(stack))
+        free(stack);
+
+    return task;
 }
 
 void task_kill(struct task *task)
@@ -146,36 +399,158 @@ void task_kill(struct task *task)
         panic("scheduler: reach unreachable...\n");
     }
 
-    list_del(&task->list);
-    task_destroy(task);
+    if (task->state & TASK_RUNNING)
+        runqueue_del(task);
+    else
+        list_del(&task->list);
+    task_zombify(task);
+
+    irq_enable();
+}
+
+void task_reap_zombies(void)
+{
+    struct task *task;
+
+    while (1) {
+        irq_disable();
+        if (list_is_empty(&zombie_list)) {
+            irq_enable();
+            return;
+        }
+
+        task = list_first_entry(&zombie_list, struct task, list);
+        list_del(&task->list);
+        irq_enable();
+
+        task_destroy(task);
+    }
+}
 
+void idle_hook_register(struct idle_hook *hook)
+{
+    RET_IF_FAIL(hook,);
+    RET_IF_FAIL(hook->hook,);
+
+    irq_disable();
+    list_add(&idle_hooks, &hook->list);
     irq_enable();
 }
 
+uint64_t scheduler_get_idle_cycles(void)
+{
+    uint64_t cycles;
+
+    irq_disable();
+    cycles = idle_cycles;
+    irq_enable();
+
+    return cycles;
+}
+
+void scheduler_idle(void)
+{
+    struct idle_hook *hook;
+    uint64_t cycles;
+
+    while (1) {
+        task_reap_zombies();
+
+        list_foreach(&idle_hooks, iter) {
+            hook = list_entry(iter, struct idle_hook, list);
+            hook->hook(hook->data);
+        }
+
+        cycles = cpu_idle();
+
+        irq_disable();
+        idle_cycles += cycles;
+        irq_enable();
+    }
+}
+
+int task_reent_init(void)
+{
+    struct task *task = task_get_running();
+    struct _reent *reent;
+
+    if (task->reent != _global_impure_ptr)
+        return 0;
+
+    reent = malloc(sizeof(*reent));
+    if (!reent)
+        return -ENOMEM;
+    _REENT_INIT_PTR(reent);
+
+    irq_disable();
+    task->reent = _impure_ptr = reent;
+    irq_enable();
+
+    return 0;
+}
+
 void task_exit(void)
 {
     kill_task = true;
     task_yield();
 }
 
-void scheduler_init(void)
+static void scheduler_start_static_tasks(void)
 {
+    extern struct static_task _tasks;
+    extern struct static_task _etasks;
     struct task *task;
 
-    task = task_create();
-    if (!task)
-        panic("scheduler: cannot allocate memory.\n");
+    for (struct static_task *st = &_tasks; st < &_etasks; st++) {
+        task = &st->task;
+
+        if (st->stack_size < TASK_STACK_MIN) {
+            kprintf("scheduler: stack of static task too small (%u < %u)\n",
+                    (unsigned) st->stack_size, (unsigned) TASK_STACK_MIN);
+            continue;
+        }
+
+        task_init(task);
+        task->state = TASK_STATIC;
+        task->priority = task->base_priority = st->priority;
+        task_init_registers(task, st->entry, NULL,
+                            (uint32_t) st->stack + st->stack_size);
+        runqueue_add(task);
+    }
+}
 
-    task->state = TASK_RUNNING;
+void scheduler_init(void)
+{
+    struct task *task = &idle_task;
+
+    task_pool_init();
 
-    list_add(&runqueue, &task->list);
+    for (int i = 0; i < TASK_PRIORITY_COUNT; i++)
+        list_init(&runqueue[i]);
+    runqueue_bitmap = 0;
+
+    task_init(task);
+    task->state = TASK_STATIC;
+    task->priority = task->base_priority = TASK_PRIORITY_IDLE;
+    task->reent = _global_impure_ptr;
+    runqueue_add(task);
+
+    scheduler_start_static_tasks();
 
     atomic_init(&is_locked, 0);
 
+#ifdef CONFIG_TASK_STATS
+    switch_timestamp = 0;
+#endif
+
     current = task;
     need_resched = false;
 
     scheduler_arch_init();
+
+    irq_disable();
+    sched_check_preempt();
+    irq_enable();
 }
 
 void schedule(uint32_t *stack_top)
@@ -185,21 +560,53 @@ void schedule(uint32_t *stack_top)
     if (atomic_get(&is_locked))
         return;
 
-    if (list_is_empty(&runqueue))
+    if (!runqueue_bitmap)
         panic("scheduler: no idle task to run\n");
 
-    memcpy(&current->registers, stack_top, sizeof(current->registers));
+    current->sp = stack_top;
 
-    list_rotate_anticlockwise(&runqueue);
-    current = list_first_entry(&runqueue, struct task, list);
+    /*
+     * A dying task must leave the runqueue before picking the next task,
+     * otherwise it could be picked again. Otherwise, move the running task
+     * to the tail of its runqueue so that tasks of equal priority
+     * round-robin.
+     */
+    if (kill_task) {
+        if (current->state & TASK_RUNNING)
+            runqueue_del(current);
+    } else if (current->state & TASK_RUNNING) {
+        list_del(&current->list);
+        list_add(&runqueue[current->priority], &current->list);
+    }
+
+    current = runqueue_pick();
     need_resched = false;
 
-    memcpy((void*) (current->registers[SP_REG] - 4),
-           &current->registers, sizeof(current->registers));
+#ifdef CONFIG_TASK_STATS
+    uint64_t now = get_cycles();
+
+    current_saved->stats.runtime += now - switch_timestamp;
+    switch_timestamp = now;
+
+    if (current != current_saved) {
+        current->stats.switch_count++;
+        if (current_saved->state & TASK_RUNNING)
+            current_saved->stats.involuntary_switches++;
+        else
+            current_saved->stats.voluntary_switches++;
+    }
+#endif
+
+    if (current != current_saved)
+        trace_record(TRACE_SWITCH, current->id);
+
+    /* most tasks share the global libc state, no need to switch it */
+    if (current->reent != _impure_ptr)
+        _impure_ptr = current->reent;
 
     if (kill_task) {
         kill_task = false;
-        task_kill(current_saved);
+        task_zombify(current_saved);
     }
 }
 
@@ -213,17 +620,50 @@ void sched_unlock(void)
     atomic_dec(&is_locked);
 }
 
+size_t task_get_info(struct task_info *info, size_t count)
+{
+    struct task *task;
+    size_t i = 0;
+
+    RET_IF_FAIL(info, 0);
+
+    irq_disable();
+
+    list_foreach(&task_list, iter) {
+        if (i >= count)
+            break;
+
+        task = list_entry(iter, struct task, all);
+        info[i].id = task->id;
+        info[i].priority = task->priority;
+        info[i].running = task->state & TASK_RUNNING;
+#ifdef CONFIG_TASK_STATS
+        info[i].stats = task->stats;
+        if (task == current)
+            info[i].stats.runtime += get_cycles() - switch_timestamp;
+#else
+        memset(&info[i].stats, 0, sizeof(info[i].stats));
+#endif
+        i++;
+    }
+
+    irq_enable();
+
+    return i;
+}
+
 static struct task *find_task_by_id(int id)
 {
     struct task *task;
 
     irq_disable();
-    list_foreach(&runqueue, iter) {
-        task = list_entry(iter, struct task, list);
+    list_foreach(&task_list, iter) {
+        task = list_entry(iter, struct task, all);
         if (id == task->id)
-            break;
-        task = NULL;
+            goto out;
     }
+    task = NULL;
+out:
     irq_enable();
 
     return task;
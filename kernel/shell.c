@@ -9,9 +9,13 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
+#include <config.h>
 #include <phabos/shell.h>
 #include <phabos/list.h>
+#include <phabos/scheduler.h>
+#include <phabos/sleep.h>
 
 #define BOLD_TEXT_ESCAPE "\033[1m"
 #define NORMAL_TEXT_ESCAPE "\033[0m"
@@ -20,6 +24,8 @@ static const char *const SHELL_PROMPT = BOLD_TEXT_ESCAPE "phabos> "
                                         NORMAL_TEXT_ESCAPE;
 #define COMMAND_LINE_MAX_SIZE   4096
 #define ARGV_MAX_SIZE           32
+#define TOP_MAX_TASKS           32
+#define TOP_REFRESH_USEC        1000000
 
 static char buffer[COMMAND_LINE_MAX_SIZE];
 static size_t history_cmd_count;
@@ -33,6 +39,11 @@ struct shell_history_command {
 
 static int hello_main(int argc, char **argv);
 static int help_main(int argc, char **argv);
+#ifdef CONFIG_TASK_STATS
+static int top_main(int argc, char **argv);
+#endif
+
+int low_getchar(bool wait);
 
 static struct shell_command *shell_get_commands(void)
 {
@@ -99,6 +110,9 @@ static size_t shell_get_command_count(void)
 __shell_command__ struct shell_command commands[] = {
     {"help", "", help_main},
     {"hello", "", hello_main},
+#ifdef CONFIG_TASK_STATS
+    {"top", "[count]", top_main},
+#endif
 };
 
 static int hello_main(int argc, char **argv)
@@ -118,6 +132,80 @@ static int help_main(int argc, char **argv)
     return 0;
 }
 
+#ifdef CONFIG_TASK_STATS
+static struct task_info *top_find_task(struct task_info *info, size_t count,
+                                       int id)
+{
+    for (int i = 0; i < count; i++) {
+        if (info[i].id == id)
+            return &info[i];
+    }
+    return NULL;
+}
+
+static int top_main(int argc, char **argv)
+{
+    static struct task_info prev[TOP_MAX_TASKS];
+    static struct task_info info[TOP_MAX_TASKS];
+    struct task_info *old;
+    size_t prev_count;
+    size_t count;
+    uint64_t prev_time;
+    uint64_t prev_idle;
+    uint64_t now;
+    uint64_t idle;
+    uint32_t elapsed;
+    uint32_t runtime;
+    uint32_t permille;
+    int iterations = argc > 1 ? atoi(argv[1]) : 0;
+
+    prev_count = task_get_info(prev, TOP_MAX_TASKS);
+    prev_time = get_cycles();
+    prev_idle = scheduler_get_idle_cycles();
+
+    for (int i = 0; !iterations || i < iterations; i++) {
+        usleep(TOP_REFRESH_USEC);
+
+        count = task_get_info(info, TOP_MAX_TASKS);
+        now = get_cycles();
+        idle = scheduler_get_idle_cycles();
+        elapsed = now - prev_time;
+
+        printf("\033[2J\033[H");
+
+        permille = (uint32_t) (idle - prev_idle) /
+                   (elapsed / 1000 ? elapsed / 1000 : 1);
+        printf("CPU sleeping: %u.%u%%\n\n",
+               (unsigned) permille / 10, (unsigned) permille % 10);
+        printf("  PID  PRIO  STATE   %%CPU   SWITCHES  VOLUNTARY  INVOLUNTARY\n");
+
+        for (int j = 0; j < count; j++) {
+            old = top_find_task(prev, prev_count, info[j].id);
+            runtime = info[j].stats.runtime - (old ? old->stats.runtime : 0);
+            permille = runtime / (elapsed / 1000 ? elapsed / 1000 : 1);
+
+            printf("%5d  %4d  %5s  %3u.%u  %9u  %9u  %11u\n",
+                   info[j].id, info[j].priority,
+                   info[j].running ? "R" : "S",
+                   (unsigned) permille / 10, (unsigned) permille % 10,
+                   (unsigned) info[j].stats.switch_count,
+                   (unsigned) info[j].stats.voluntary_switches,
+                   (unsigned) info[j].stats.involuntary_switches);
+        }
+
+        memcpy(prev, info, count * sizeof(*info));
+        prev_count = count;
+        prev_time = now;
+        prev_idle = idle;
+
+        if (low_getchar(false) != EOF)
+            break;
+    }
+
+    return 0;
+}
+#endif
+
 static void shell_putc(char c)
 {
     if (c == '\n')
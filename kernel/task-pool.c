@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <phabos/task-pool.h>
+#include <phabos/scheduler.h>
+#include <phabos/utils.h>
+#include <phabos/kprintf.h>
+#include <asm/irq.h>
+
+/*
+ * The pools are reserved in .bss, so their footprint is known at link time
+ * and creating or destroying a pooled task is O(1) and never depends on the
+ * state of the heap. Free task control blocks are linked through their list
+ * node, free stacks through their first word.
+ */
+
+#define STACK_ALIGNMENT 8
+
+struct stack_pool {
+    size_t stack_size;
+    size_t stack_count;
+    uint8_t *storage;
+    void *free_list;
+};
+
+static struct task task_pool[CONFIG_TASK_POOL_SIZE];
+static struct list_head task_free_list = LIST_INIT(task_free_list);
+
+static uint64_t small_stacks[CONFIG_STACK_POOL_SMALL_COUNT]
+                            [CONFIG_STACK_POOL_SMALL_SIZE / STACK_ALIGNMENT];
+static uint64_t medium_stacks[CONFIG_STACK_POOL_MEDIUM_COUNT]
+                             [CONFIG_STACK_POOL_MEDIUM_SIZE / STACK_ALIGNMENT];
+static uint64_t large_stacks[CONFIG_STACK_POOL_LARGE_COUNT]
+                            [CONFIG_STACK_POOL_LARGE_SIZE / STACK_ALIGNMENT];
+
+/* sorted by increasing stack size */
+static struct stack_pool stack_pools[] = {
+    {
+        .stack_size = sizeof(small_stacks[0]),
+        .stack_count = ARRAY_SIZE(small_stacks),
+        .storage = (uint8_t*) small_stacks,
+    },
+    {
+        .stack_size = sizeof(medium_stacks[0]),
+        .stack_count = ARRAY_SIZE(medium_stacks),
+        .storage = (uint8_t*) medium_stacks,
+    },
+    {
+        .stack_size = sizeof(large_stacks[0]),
+        .stack_count = ARRAY_SIZE(large_stacks),
+        .storage = (uint8_t*) large_stacks,
+    },
+};
+
+void task_pool_init(void)
+{
+    struct stack_pool *pool;
+    void **stack;
+
+    for (int i = 0; i < ARRAY_SIZE(task_pool); i++)
+        list_add(&task_free_list, &task_pool[i].list);
+
+    for (int i = 0; i < ARRAY_SIZE(stack_pools); i++) {
+        pool = &stack_pools[i];
+        pool->free_list = NULL;
+
+        /* a pool too small for any task is left empty */
+        if (pool->stack_size < TASK_STACK_MIN) {
+            kprintf("task-pool: %u-byte stacks below the minimum of %u\n",
+                    (unsigned) pool->stack_size, (unsigned) TASK_STACK_MIN);
+            continue;
+        }
+
+        for (int j = pool->stack_count - 1; j >= 0; j--) {
+            stack = (void**) (pool->storage + j * pool->stack_size);
+            *stack = pool->free_list;
+            pool->free_list = stack;
+        }
+    }
+}
+
+struct task *task_pool_alloc(void)
+{
+    struct task *task = NULL;
+
+    irq_disable();
+    if (!list_is_empty(&task_free_list)) {
+        task = list_first_entry(&task_free_list, struct task, list);
+        list_del(&task->list);
+    }
+    irq_enable();
+
+    if (task)
+        memset(task, 0, sizeof(*task));
+
+    return task;
+}
+
+bool task_pool_free(struct task *task)
+{
+    if (task < task_pool || task >= task_pool + ARRAY_SIZE(task_pool))
+        return false;
+
+    irq_disable();
+    list_add(&task_free_list, &task->list);
+    irq_enable();
+
+    return true;
+}
+
+void *stack_pool_alloc(size_t *size)
+{
+    struct stack_pool *pool;
+    void **stack = NULL;
+
+    irq_disable();
+
+    for (int i = 0; i < ARRAY_SIZE(stack_pools); i++) {
+        pool = &stack_pools[i];
+        if (pool->stack_size < *size || !pool->free_list)
+            continue;
+
+        stack = pool->free_list;
+        pool->free_list = *stack;
+        *size = pool->stack_size;
+        break;
+    }
+
+    irq_enable();
+
+    return stack;
+}
+
+bool stack_pool_free(void *stack)
+{
+    struct stack_pool *pool;
+    uint8_t *addr = stack;
+
+    for (int i = 0; i < ARRAY_SIZE(stack_pools); i++) {
+        pool = &stack_pools[i];
+        if (addr < pool->storage ||
+            addr >= pool->storage + pool->stack_size * pool->stack_count)
+            continue;
+
+        irq_disable();
+        *(void**) stack = pool->free_list;
+        pool->free_list = stack;
+        irq_enable();
+
+        return true;
+    }
+
+    return false;
+}
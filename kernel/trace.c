@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2014-2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <config.h>
+#include <phabos/trace.h>
+#include <phabos/shell.h>
+#include <phabos/scheduler.h>
+#include <asm/atomic.h>
+#include <asm/machine.h>
+
+#define TRACE_SIZE (1 << CONFIG_TRACE_ORDER)
+
+/*
+ * Writers reserve a slot by incrementing trace_head, so any context can
+ * record an event without taking a lock. Once the ring is full, the oldest
+ * entries are overwritten.
+ */
+static struct trace_entry trace_ring[TRACE_SIZE];
+static atomic_t trace_head;
+bool trace_enabled;
+
+static int trace_main(int argc, char **argv);
+
+__shell_command__ struct shell_command trace_commands[] = {
+    {"trace", "start|stop|dump", trace_main},
+};
+
+void __trace_record(enum trace_event event, uint32_t arg)
+{
+    struct task *task = task_get_running();
+    struct trace_entry *entry;
+
+    entry = &trace_ring[(atomic_inc(&trace_head) - 1) & (TRACE_SIZE - 1)];
+    entry->timestamp = get_cycles_raw();
+    entry->event = event;
+    entry->task = task ? task->id : 0;
+    entry->arg = arg;
+}
+
+void trace_start(void)
+{
+    trace_enabled = false;
+    memset(trace_ring, 0, sizeof(trace_ring));
+    atomic_init(&trace_head, 0);
+    trace_enabled = true;
+}
+
+void trace_stop(void)
+{
+    trace_enabled = false;
+}
+
+/*
+ * Dump format, parsed by scripts/trace2json.py:
+ *   TRACE <cpu frequency> <entry count>
+ *   <timestamp> <event> <task> <arg>
+ *   ...
+ *   TRACE END
+ */
+static void trace_dump(void)
+{
+    uint32_t head = atomic_get(&trace_head);
+    uint32_t first = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+    struct trace_entry *entry;
+
+    printf("TRACE %u %u\n", CPU_FREQ, (unsigned) (head - first));
+    for (uint32_t i = first; i < head; i++) {
+        entry = &trace_ring[i & (TRACE_SIZE - 1)];
+        printf("%08x %u %u %08x\n", (unsigned) entry->timestamp, entry->event,
+               entry->task, (unsigned) entry->arg);
+    }
+    printf("TRACE END\n");
+}
+
+static int trace_main(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("usage: %s start|stop|dump\n", argv[0]);
+        return -1;
+    }
+
+    if (!strcmp(argv[1], "start")) {
+        trace_start();
+    } else if (!strcmp(argv[1], "stop")) {
+        trace_stop();
+    } else if (!strcmp(argv[1], "dump")) {
+        trace_stop();
+        trace_dump();
+    } else {
+        printf("%s: unknown action '%s'\n", argv[0], argv[1]);
+        return -1;
+    }
+
+    return 0;
+}
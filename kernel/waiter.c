@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <phabos/waiter.h>
+#include <phabos/scheduler.h>
+#include <asm/irq.h>
+
+void waiter_wait(struct list_head *waiters, struct waiter *waiter)
+{
+    struct list_head *iter;
+    struct waiter *w;
+
+    waiter->task = task_get_running();
+    waiter->done = false;
+    list_init(&waiter->wait_list);
+
+    for (iter = waiters->next; iter != waiters; iter = iter->next) {
+        w = list_entry(iter, struct waiter, list);
+        if (w->task->priority < waiter->task->priority)
+            break;
+    }
+    list_add(iter, &waiter->list);
+
+    while (!waiter->done) {
+        task_add_to_wait_list(waiter->task, &waiter->wait_list);
+        irq_enable();
+        task_yield();
+        irq_disable();
+    }
+}
+
+struct waiter *waiter_first(struct list_head *waiters)
+{
+    if (list_is_empty(waiters))
+        return NULL;
+    return list_first_entry(waiters, struct waiter, list);
+}
+
+void waiter_wake(struct waiter *waiter)
+{
+    list_del(&waiter->list);
+    waiter->done = true;
+    task_remove_from_wait_list(waiter->task);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <phabos/div64.h>
+
+uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder)
+{
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend;
+    uint64_t quotient;
+    uint64_t rem;
+
+    if (!high) {
+        *remainder = low % divisor;
+        return low / divisor;
+    }
+
+    quotient = (uint64_t) (high / divisor) << 32;
+    rem = high % divisor;
+
+    /* rem < divisor, so shifting one more bit in never overflows 33 bits */
+    for (int i = 31; i >= 0; i--) {
+        rem = (rem << 1) | ((low >> i) & 1);
+        if (rem >= divisor) {
+            rem -= divisor;
+            quotient |= 1u << i;
+        }
+    }
+
+    *remainder = rem;
+    return quotient;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdbool.h>
+
+#include <phabos/event-flags.h>
+#include <phabos/waiter.h>
+#include <phabos/assert.h>
+#include <asm/irq.h>
+
+struct event_flags_waiter {
+    struct waiter waiter;
+    uint32_t mask;
+    unsigned options;
+    uint32_t result;
+};
+
+static bool event_flags_match(uint32_t flags, uint32_t mask, unsigned options)
+{
+    if (options & EVENT_FLAGS_ALL)
+        return (flags & mask) == mask;
+    return flags & mask;
+}
+
+void event_flags_init(struct event_flags *ef)
+{
+    RET_IF_FAIL(ef,);
+
+    ef->flags = 0;
+    list_init(&ef->waiters);
+}
+
+uint32_t event_flags_wait(struct event_flags *ef, uint32_t mask,
+                          unsigned options)
+{
+    struct event_flags_waiter waiter;
+
+    RET_IF_FAIL(ef, 0);
+    RET_IF_FAIL(mask, 0);
+
+    irq_disable();
+
+    if (event_flags_match(ef->flags, mask, options)) {
+        waiter.result = ef->flags;
+        if (options & EVENT_FLAGS_CLEAR)
+            ef->flags &= ~mask;
+        irq_enable();
+        return waiter.result;
+    }
+
+    waiter.mask = mask;
+    waiter.options = options;
+    waiter_wait(&ef->waiters, &waiter.waiter);
+
+    irq_enable();
+
+    return waiter.result;
+}
+
+/*
+ * Every waiter satisfied by the new flags is woken up in a single pass and
+ * sees the same flags. The flags to clear on exit are only cleared once the
+ * pass is over.
+ */
+uint32_t event_flags_set(struct event_flags *ef, uint32_t mask)
+{
+    struct event_flags_waiter *waiter;
+    uint32_t clear = 0;
+    uint32_t flags;
+
+    RET_IF_FAIL(ef, 0);
+
+    irq_disable();
+
+    ef->flags |= mask;
+
+    list_foreach_safe(&ef->waiters, iter) {
+        waiter = list_entry(iter, struct event_flags_waiter, waiter.list);
+
+        if (!event_flags_match(ef->flags, waiter->mask, waiter->options))
+            continue;
+
+        if (waiter->options & EVENT_FLAGS_CLEAR)
+            clear |= waiter->mask;
+
+        waiter->result = ef->flags;
+        waiter_wake(&waiter->waiter);
+    }
+
+    ef->flags &= ~clear;
+    flags = ef->flags;
+
+    irq_enable();
+
+    return flags;
+}
+
+uint32_t event_flags_clear(struct event_flags *ef, uint32_t mask)
+{
+    uint32_t flags;
+
+    RET_IF_FAIL(ef, 0);
+
+    irq_disable();
+    flags = ef->flags;
+    ef->flags &= ~mask;
+    irq_enable();
+
+    return flags;
+}
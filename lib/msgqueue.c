@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <phabos/msgqueue.h>
+#include <phabos/waiter.h>
+#include <phabos/utils.h>
+#include <phabos/assert.h>
+#include <asm/irq.h>
+
+/* Waiting senders carry their message, waiting receivers their buffer */
+struct msgqueue_waiter {
+    struct waiter waiter;
+    void *msg;
+};
+
+struct msgqueue *msgqueue_create(size_t elem_size, unsigned depth)
+{
+    struct msgqueue *mq;
+
+    RET_IF_FAIL(elem_size, NULL);
+    RET_IF_FAIL(depth, NULL);
+
+    mq = malloc(sizeof(*mq) + elem_size * depth);
+    if (!mq)
+        return NULL;
+    msgqueue_init(mq, mq + 1, elem_size, depth);
+
+    return mq;
+}
+
+void msgqueue_init(struct msgqueue *mq, void *buffer, size_t elem_size,
+                   unsigned depth)
+{
+    RET_IF_FAIL(mq,);
+    RET_IF_FAIL(buffer,);
+
+    memset(mq, 0, sizeof(*mq));
+    mq->buffer = buffer;
+    mq->elem_size = elem_size;
+    mq->depth = depth;
+    list_init(&mq->senders);
+    list_init(&mq->receivers);
+}
+
+void msgqueue_destroy(struct msgqueue *mq)
+{
+    if (!mq)
+        return;
+
+    RET_IF_FAIL(list_is_empty(&mq->senders),);
+    RET_IF_FAIL(list_is_empty(&mq->receivers),);
+    free(mq);
+}
+
+/* Must be called with the interrupts disabled for all the helpers below */
+static void msgqueue_push(struct msgqueue *mq, const void *msg)
+{
+    unsigned tail = mq->head + mq->count;
+
+    if (tail >= mq->depth)
+        tail -= mq->depth;
+
+    memcpy(mq->buffer + tail * mq->elem_size, msg, mq->elem_size);
+    mq->count++;
+}
+
+static void msgqueue_pop(struct msgqueue *mq, void *msg)
+{
+    memcpy(msg, mq->buffer + mq->head * mq->elem_size, mq->elem_size);
+
+    if (++mq->head == mq->depth)
+        mq->head = 0;
+    mq->count--;
+}
+
+static struct msgqueue_waiter *msgqueue_get_waiter(struct list_head *waiters)
+{
+    struct waiter *waiter = waiter_first(waiters);
+
+    return waiter ? containerof(waiter, struct msgqueue_waiter, waiter) : NULL;
+}
+
+/*
+ * Receivers only wait on an empty queue, so a waiting receiver takes the
+ * message directly.
+ */
+static bool __msgqueue_trysend(struct msgqueue *mq, const void *msg)
+{
+    struct msgqueue_waiter *receiver = msgqueue_get_waiter(&mq->receivers);
+
+    if (receiver) {
+        memcpy(receiver->msg, msg, mq->elem_size);
+        waiter_wake(&receiver->waiter);
+        return true;
+    }
+
+    if (mq->count == mq->depth)
+        return false;
+
+    msgqueue_push(mq, msg);
+    return true;
+}
+
+/*
+ * Senders only wait on a full queue, the slot freed by the receiver goes to
+ * the most urgent of them.
+ */
+static bool __msgqueue_tryreceive(struct msgqueue *mq, void *msg)
+{
+    struct msgqueue_waiter *sender;
+
+    if (!mq->count)
+        return false;
+
+    msgqueue_pop(mq, msg);
+
+    sender = msgqueue_get_waiter(&mq->senders);
+    if (sender) {
+        msgqueue_push(mq, sender->msg);
+        waiter_wake(&sender->waiter);
+    }
+
+    return true;
+}
+
+void msgqueue_send(struct msgqueue *mq, const void *msg)
+{
+    struct msgqueue_waiter waiter;
+
+    RET_IF_FAIL(mq,);
+    RET_IF_FAIL(msg,);
+
+    irq_disable();
+    if (!__msgqueue_trysend(mq, msg)) {
+        waiter.msg = (void*) msg;
+        waiter_wait(&mq->senders, &waiter.waiter);
+    }
+    irq_enable();
+}
+
+bool msgqueue_trysend(struct msgqueue *mq, const void *msg)
+{
+    bool sent;
+
+    RET_IF_FAIL(mq, false);
+    RET_IF_FAIL(msg, false);
+
+    irq_disable();
+    sent = __msgqueue_trysend(mq, msg);
+    irq_enable();
+
+    return sent;
+}
+
+void msgqueue_receive(struct msgqueue *mq, void *msg)
+{
+    struct msgqueue_waiter waiter;
+
+    RET_IF_FAIL(mq,);
+    RET_IF_FAIL(msg,);
+
+    irq_disable();
+    if (!__msgqueue_tryreceive(mq, msg)) {
+        waiter.msg = msg;
+        waiter_wait(&mq->receivers, &waiter.waiter);
+    }
+    irq_enable();
+}
+
+bool msgqueue_tryreceive(struct msgqueue *mq, void *msg)
+{
+    bool received;
+
+    RET_IF_FAIL(mq, false);
+    RET_IF_FAIL(msg, false);
+
+    irq_disable();
+    received = __msgqueue_tryreceive(mq, msg);
+    irq_enable();
+
+    return received;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <phabos/mutex.h>
+#include <phabos/list.h>
+#include <phabos/scheduler.h>
+#include <phabos/assert.h>
+#include <phabos/panic.h>
+#include <phabos/utils.h>
+#include <asm/irq.h>
+
+#define MUTEX_HAS_WAITERS       (1 << 0)
+#define MUTEX_MAX_CHAIN_DEPTH   8
+
+static inline struct task *mutex_get_owner(struct mutex *mutex)
+{
+    return (struct task*) (atomic_get(&mutex->owner) & ~MUTEX_HAS_WAITERS);
+}
+
+/* Must be called with the interrupts disabled */
+static int mutex_waiter_priority(struct mutex *mutex)
+{
+    struct task *waiter;
+
+    if (list_is_empty(&mutex->wait_list))
+        return TASK_PRIORITY_IDLE;
+
+    waiter = list_first_entry(&mutex->wait_list, struct task, list);
+    return waiter->priority;
+}
+
+int mutex_inherited_priority(struct task *task)
+{
+    struct mutex *mutex;
+    int priority = task->base_priority;
+
+    list_foreach(&task->held_mutexes, iter) {
+        mutex = list_entry(iter, struct mutex, held);
+        priority = MAX(priority, mutex_waiter_priority(mutex));
+    }
+
+    return priority;
+}
+
+/*
+ * Boost the owner of the mutex to the priority of its most urgent waiter. If
+ * the owner is itself waiting for a mutex, the boost is propagated along the
+ * chain of owners.
+ *
+ * Must be called with the interrupts disabled
+ */
+static void mutex_propagate_priority(struct mutex *mutex)
+{
+    struct task *owner;
+    int priority;
+
+    for (int i = 0; mutex && i < MUTEX_MAX_CHAIN_DEPTH; i++) {
+        owner = mutex_get_owner(mutex);
+        if (!owner)
+            return;
+
+        priority = mutex_waiter_priority(mutex);
+        if (owner->priority >= priority)
+            return;
+
+        task_change_priority(owner, priority);
+        mutex = owner->blocked_on;
+    }
+}
+
+struct mutex *mutex_create(void)
+{
+    struct mutex *mutex;
+
+    mutex = malloc(sizeof(*mutex));
+    if (!mutex)
+        return NULL;
+    mutex_init(mutex);
+
+    return mutex;
+}
+
+void mutex_init(struct mutex *mutex)
+{
+    RET_IF_FAIL(mutex,);
+
+    memset(mutex, 0, sizeof(*mutex));
+    atomic_init(&mutex->owner, 0);
+    list_init(&mutex->wait_list);
+    list_init(&mutex->held);
+}
+
+void mutex_destroy(struct mutex *mutex)
+{
+    if (!mutex)
+        return;
+
+    RET_IF_FAIL(!atomic_get(&mutex->owner),);
+    free(mutex);
+}
+
+/*
+ * A waiter that timed out left the wait list, the owner may no longer have
+ * waiters to inherit from. Must be called with the interrupts disabled.
+ */
+static void mutex_remove_waiter(struct mutex *mutex)
+{
+    struct task *owner = mutex_get_owner(mutex);
+
+    if (!owner)
+        return;
+
+    if (list_is_empty(&mutex->wait_list) &&
+        (atomic_get(&mutex->owner) & MUTEX_HAS_WAITERS)) {
+        list_del(&mutex->held);
+        atomic_init(&mutex->owner, (uint32_t) owner);
+    }
+
+    task_change_priority(owner, mutex_inherited_priority(owner));
+}
+
+static int mutex_lock_slowpath(struct mutex *mutex, struct task *task,
+                               struct task_timeout *timeout)
+{
+    uint32_t owner;
+    int retval = 0;
+
+    irq_disable();
+
+    while (mutex_get_owner(mutex) != task) {
+        owner = atomic_get(&mutex->owner);
+
+        if (!owner) {
+            if (!atomic_cmpxchg(&mutex->owner, 0, (uint32_t) task))
+                break;
+            continue;
+        }
+
+        if (timeout && timeout->expired) {
+            mutex_remove_waiter(mutex);
+            retval = -ETIMEDOUT;
+            break;
+        }
+
+        if (!(owner & MUTEX_HAS_WAITERS)) {
+            if (atomic_cmpxchg(&mutex->owner, owner,
+                               owner | MUTEX_HAS_WAITERS) != owner)
+                continue;
+            list_add(&mutex_get_owner(mutex)->held_mutexes, &mutex->held);
+        }
+
+        task->blocked_on = mutex;
+        task_add_to_wait_list(task, &mutex->wait_list);
+        mutex_propagate_priority(mutex);
+
+        irq_enable();
+        task_yield();
+        irq_disable();
+
+        task->blocked_on = NULL;
+    }
+
+    irq_enable();
+    return retval;
+}
+
+void mutex_lock(struct mutex *mutex)
+{
+    struct task *task = task_get_running();
+
+    RET_IF_FAIL(mutex,);
+    RET_IF_FAIL(task,);
+
+    if (!atomic_cmpxchg(&mutex->owner, 0, (uint32_t) task))
+        return;
+
+    if (mutex_get_owner(mutex) == task)
+        panic("mutex: recursive locking\n");
+
+    mutex_lock_slowpath(mutex, task, NULL);
+}
+
+int mutex_lock_timeout(struct mutex *mutex, unsigned long usec)
+{
+    struct task *task = task_get_running();
+    struct task_timeout timeout;
+    int retval;
+
+    RET_IF_FAIL(mutex, -EINVAL);
+    RET_IF_FAIL(task, -EINVAL);
+
+    if (!atomic_cmpxchg(&mutex->owner, 0, (uint32_t) task))
+        return 0;
+
+    if (mutex_get_owner(mutex) == task)
+        panic("mutex: recursive locking\n");
+
+    task_timeout_start(&timeout, usec);
+    retval = mutex_lock_slowpath(mutex, task, &timeout);
+    task_timeout_stop(&timeout);
+
+    return retval;
+}
+
+bool mutex_trylock(struct mutex *mutex)
+{
+    struct task *task = task_get_running();
+
+    RET_IF_FAIL(mutex, false);
+    RET_IF_FAIL(task, false);
+
+    return !atomic_cmpxchg(&mutex->owner, 0, (uint32_t) task);
+}
+
+static void mutex_unlock_slowpath(struct mutex *mutex, struct task *task)
+{
+    struct task *waiter;
+    uint32_t owner = 0;
+
+    irq_disable();
+
+    list_del(&mutex->held);
+
+    /*
+     * Hand the mutex over to the most urgent waiter, it inherits from the
+     * remaining waiters if there are any.
+     */
+    if (!list_is_empty(&mutex->wait_list)) {
+        waiter = list_first_entry(&mutex->wait_list, struct task, list);
+        owner = (uint32_t) waiter;
+
+        if (waiter->list.next != &mutex->wait_list) {
+            owner |= MUTEX_HAS_WAITERS;
+            list_add(&waiter->held_mutexes, &mutex->held);
+        }
+
+        atomic_init(&mutex->owner, owner);
+        task_remove_from_wait_list(waiter);
+        task_change_priority(waiter, mutex_inherited_priority(waiter));
+    } else {
+        atomic_init(&mutex->owner, 0);
+    }
+
+    task_change_priority(task, mutex_inherited_priority(task));
+
+    irq_enable();
+}
+
+void mutex_unlock(struct mutex *mutex)
+{
+    struct task *task = task_get_running();
+
+    RET_IF_FAIL(mutex,);
+    RET_IF_FAIL(mutex_get_owner(mutex) == task,);
+
+    if (atomic_cmpxchg(&mutex->owner, (uint32_t) task, 0) == (uint32_t) task)
+        return;
+
+    mutex_unlock_slowpath(mutex, task);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <phabos/ringbuf.h>
+#include <phabos/utils.h>
+#include <phabos/assert.h>
+#include <asm/barrier.h>
+
+/*
+ * The producer fills the buffer before publishing the new head, and the
+ * consumer reads the head before reading the buffer: a barrier sits between
+ * the two on each side. The same goes for the tail in the other direction,
+ * so that the producer never overwrites bytes still being read.
+ */
+
+int ringbuf_init(struct ringbuf *rb, void *buffer, size_t size)
+{
+    RET_IF_FAIL(rb, -EINVAL);
+    RET_IF_FAIL(buffer, -EINVAL);
+
+    if (!size || (size & (size - 1)))
+        return -EINVAL;
+
+    rb->buffer = buffer;
+    rb->size = size;
+    rb->head = rb->tail = 0;
+
+    return 0;
+}
+
+struct ringbuf *ringbuf_create(size_t size)
+{
+    struct ringbuf *rb;
+
+    rb = malloc(sizeof(*rb) + size);
+    if (!rb)
+        return NULL;
+
+    if (ringbuf_init(rb, rb + 1, size)) {
+        free(rb);
+        return NULL;
+    }
+
+    return rb;
+}
+
+void ringbuf_destroy(struct ringbuf *rb)
+{
+    free(rb);
+}
+
+void *ringbuf_write_span(struct ringbuf *rb, size_t *len)
+{
+    size_t head = rb->head;
+    size_t offset = head & (rb->size - 1);
+
+    RET_IF_FAIL(len, NULL);
+
+    /* order the read of the tail with our writes into the buffer */
+    *len = MIN(rb->size - (head - rb->tail), rb->size - offset);
+    dmb();
+
+    return rb->buffer + offset;
+}
+
+void ringbuf_write_commit(struct ringbuf *rb, size_t len)
+{
+    dmb();
+    rb->head += len;
+}
+
+const void *ringbuf_read_span(struct ringbuf *rb, size_t *len)
+{
+    size_t tail = rb->tail;
+    size_t offset = tail & (rb->size - 1);
+
+    RET_IF_FAIL(len, NULL);
+
+    /* the bytes behind the head must not be read before the head itself */
+    *len = MIN(rb->head - tail, rb->size - offset);
+    dmb();
+
+    return rb->buffer + offset;
+}
+
+void ringbuf_read_commit(struct ringbuf *rb, size_t len)
+{
+    dmb();
+    rb->tail += len;
+}
+
+size_t ringbuf_enqueue(struct ringbuf *rb, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    size_t copied = 0;
+    size_t span;
+    void *dst;
+
+    /* at most two spans when the free space wraps around */
+    for (int i = 0; i < 2 && copied < len; i++) {
+        dst = ringbuf_write_span(rb, &span);
+        if (!span)
+            break;
+
+        span = MIN(span, len - copied);
+        memcpy(dst, src + copied, span);
+        ringbuf_write_commit(rb, span);
+        copied += span;
+    }
+
+    return copied;
+}
+
+size_t ringbuf_dequeue(struct ringbuf *rb, void *data, size_t len)
+{
+    uint8_t *dst = data;
+    size_t copied = 0;
+    size_t span;
+    const void *src;
+
+    for (int i = 0; i < 2 && copied < len; i++) {
+        src = ringbuf_read_span(rb, &span);
+        if (!span)
+            break;
+
+        span = MIN(span, len - copied);
+        memcpy(dst + copied, src, span);
+        ringbuf_read_commit(rb, span);
+        copied += span;
+    }
+
+    return copied;
+}
@@ -8,10 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <phabos/semaphore.h>
 #include <phabos/list.h>
 #include <phabos/scheduler.h>
 #include <phabos/assert.h>
+#include <phabos/trace.h>
 #include <asm/irq.h>
 
 struct semaphore *semaphore_create(unsigned val)
@@ -44,20 +46,68 @@ void semaphore_destroy(struct semaphore *semaphore)
     free(semaphore);
 }
 
-void semaphore_lock(struct semaphore *semaphore)
+/*
+ * Block until the semaphore can be taken or until the timeout, if any,
+ * expires. Must be called with the interrupts disabled.
+ */
+static int __semaphore_lock(struct semaphore *semaphore,
+                            struct task_timeout *timeout)
 {
-    RET_IF_FAIL(semaphore,);
+    bool blocked = false;
 
-    irq_disable();
     while (atomic_get(&semaphore->count) <= 0) {
+        if (timeout && timeout->expired)
+            return -ETIMEDOUT;
+
+        if (!blocked) {
+            trace_record(TRACE_SEM_BLOCK, (uint32_t) semaphore);
+            blocked = true;
+        }
+
         task_add_to_wait_list(task_get_running(), &semaphore->wait_list);
         irq_enable();
         task_yield();
         irq_disable();
     }
 
+    if (blocked)
+        trace_record(TRACE_SEM_UNBLOCK, (uint32_t) semaphore);
+
     atomic_dec(&semaphore->count);
+    return 0;
+}
+
+void semaphore_lock(struct semaphore *semaphore)
+{
+    RET_IF_FAIL(semaphore,);
+
+    irq_disable();
+    __semaphore_lock(semaphore, NULL);
+    irq_enable();
+}
+
+int semaphore_lock_timeout(struct semaphore *semaphore, unsigned long usec)
+{
+    struct task_timeout timeout;
+    int retval;
+
+    RET_IF_FAIL(semaphore, -EINVAL);
+
+    irq_disable();
+
+    if (atomic_get(&semaphore->count) > 0) {
+        atomic_dec(&semaphore->count);
+        irq_enable();
+        return 0;
+    }
+
+    task_timeout_start(&timeout, usec);
+    retval = __semaphore_lock(semaphore, &timeout);
+
     irq_enable();
+
+    task_timeout_stop(&timeout);
+    return retval;
 }
 
 bool semaphore_trylock(struct semaphore *semaphore)
@@ -79,9 +129,14 @@ void semaphore_unlock(struct semaphore *semaphore)
 {
     RET_IF_FAIL(semaphore,);
 
+    irq_disable();
+
     atomic_inc(&semaphore->count);
 
+    /* the wait list is sorted by priority: wake up the most urgent waiter */
     if (!list_is_empty(&semaphore->wait_list))
         task_remove_from_wait_list(list_first_entry(&semaphore->wait_list,
                                                     struct task, list));
+
+    irq_enable();
 }
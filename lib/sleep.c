@@ -5,14 +5,39 @@
  * Provided under the three clause BSD license found in the LICENSE file.
  */
 
+#include <config.h>
 #include <phabos/list.h>
 #include <phabos/sleep.h>
 #include <phabos/semaphore.h>
 #include <phabos/watchdog.h>
+#include <phabos/hrtimer.h>
 #include <phabos/assert.h>
 
 extern struct task *current;
 
+#ifdef CONFIG_HRTIMER
+static void usleep_timeout(struct hrtimer *timer)
+{
+    RET_IF_FAIL(timer,);
+    RET_IF_FAIL(timer->data,);
+
+    semaphore_unlock(timer->data);
+}
+
+int usleep(useconds_t usec)
+{
+    struct semaphore semaphore;
+    struct hrtimer timer;
+
+    semaphore_init(&semaphore, 0);
+    hrtimer_init(&timer, usleep_timeout, &semaphore);
+
+    hrtimer_start(&timer, usec);
+    semaphore_lock(&semaphore);
+
+    return 0;
+}
+#else
 static void usleep_timeout(struct watchdog *watchdog)
 {
     RET_IF_FAIL(watchdog,);
@@ -34,7 +59,7 @@ int usleep(useconds_t usec)
 
     watchdog_start(&watchdog, usec);
     semaphore_lock(&semaphore);
-    watchdog_delete(&watchdog);
 
     return 0;
 }
+#endif
@@ -9,18 +9,30 @@
 #include <time.h>
 
 #include <phabos/time.h>
+#include <phabos/div64.h>
 #include <phabos/assert.h>
 #include <asm/scheduler.h>
 #include <asm/machine.h>
 
+#define NSEC_PER_SEC    1000000000
+#define NSEC_PER_TICK   (NSEC_PER_SEC / HZ)
+
+/* nanoseconds per cycle as a 32.32 fixed point number, folded at build time */
+#define NSEC_PER_CYCLE  (((uint64_t) NSEC_PER_SEC << 32) / CPU_FREQ)
+
 static int clock_monotonic_gettime(struct timespec *tp)
 {
-    uint32_t ticks = get_ticks(); // FIXME uint64_t
+    uint64_t ticks;
+    uint32_t cycles;
+    uint32_t rem;
 
     RET_IF_FAIL(tp, -EINVAL);
 
-    tp->tv_sec = ticks / HZ;
-    tp->tv_nsec = ticks % HZ;
+    ticks = get_tick_cycles(&cycles);
+
+    tp->tv_sec = div_u64_rem(ticks, HZ, &rem);
+    tp->tv_nsec = rem * NSEC_PER_TICK +
+                  (uint32_t) ((cycles * NSEC_PER_CYCLE) >> 32);
 
     return 0;
 }
@@ -13,6 +13,12 @@
 #include <string.h>
 #include <errno.h>
 
+/*
+ * Delayed work is allowed to run up to 1/256th of its delay late, like the
+ * default timer slack of Linux, so that close deadlines share a wakeup.
+ */
+#define WORKQUEUE_SLACK_DIVISOR 256
+
 void workqueue_thread(void *data)
 {
     struct workqueue *wq = data;
@@ -20,6 +26,9 @@ void workqueue_thread(void *data)
 
     RET_IF_FAIL(data,);
 
+    /* works may run anything, give them a libc state of their own */
+    task_reent_init();
+
     while (1) {
         semaphore_lock(&wq->semaphore);
 
@@ -35,7 +44,9 @@ void workqueue_thread(void *data)
             if (work->entry_point)
                 work->entry_point(work->data);
 
-            watchdog_delete(&work->watchdog);
+#ifndef CONFIG_HRTIMER
+            watchdog_cancel(&work->watchdog);
+#endif
             free(work);
             break;
         }
@@ -45,17 +56,28 @@ void workqueue_thread(void *data)
     }
 }
 
-void workqueue_delay_timeout(struct watchdog *wd)
+static void workqueue_delay_expired(struct work *work)
 {
-    struct work *work = containerof(wd, struct work, watchdog);
-
-    RET_IF_FAIL(wd,);
     RET_IF_FAIL(work->wq,);
 
     work->is_schedulable = true;
     semaphore_unlock(&work->wq->semaphore);
 }
 
+#ifdef CONFIG_HRTIMER
+static void workqueue_delay_timeout(struct hrtimer *timer)
+{
+    RET_IF_FAIL(timer,);
+    workqueue_delay_expired(containerof(timer, struct work, timer));
+}
+#else
+void workqueue_delay_timeout(struct watchdog *wd)
+{
+    RET_IF_FAIL(wd,);
+    workqueue_delay_expired(containerof(wd, struct work, watchdog));
+}
+#endif
+
 struct workqueue *workqueue_create(const char *name)
 {
     struct workqueue *wq;
@@ -97,6 +119,11 @@ void workqueue_destroy(struct workqueue *wq)
     list_foreach_safe(&wq->list, iter) {
         work = list_entry(iter, struct work, list);
         list_del(&work->list);
+#ifdef CONFIG_HRTIMER
+        hrtimer_cancel(&work->timer);
+#else
+        watchdog_cancel(&work->watchdog);
+#endif
         free(work);
     }
 
@@ -131,9 +158,15 @@ void workqueue_schedule(struct workqueue *wq, work_entry_t callback,
     work->is_schedulable = delay ? false : true;
     list_init(&work->list);
 
+#ifdef CONFIG_HRTIMER
+    hrtimer_init(&work->timer, workqueue_delay_timeout, work);
+    hrtimer_set_slack(&work->timer, delay / WORKQUEUE_SLACK_DIVISOR);
+#else
     watchdog_init(&work->watchdog);
     work->watchdog.timeout = workqueue_delay_timeout;
     work->watchdog.user_priv = work;
+    watchdog_set_slack(&work->watchdog, delay / WORKQUEUE_SLACK_DIVISOR);
+#endif
     work->wq = wq;
 
     if (atomic_inc(&wq->work_count) == 1)
@@ -144,7 +177,11 @@ void workqueue_schedule(struct workqueue *wq, work_entry_t callback,
     spinlock_unlock(&wq->lock);
 
     if (delay)
+#ifdef CONFIG_HRTIMER
+        hrtimer_start(&work->timer, delay);
+#else
         watchdog_start(&work->watchdog, delay);
+#endif
     else
         semaphore_unlock(&wq->semaphore);
 }
@@ -157,11 +194,16 @@ bool workqueue_has_pending_work(struct workqueue *wq)
 
 int workqueue_wait_empty(struct workqueue *wq, int timeout)
 {
+    int retval = 0;
+
     RET_IF_FAIL(wq, -EINVAL);
 
-    // TODO implement the timeout
+    if (timeout > 0)
+        retval = semaphore_lock_timeout(&wq->empty_semaphore, timeout);
+    else
+        semaphore_lock(&wq->empty_semaphore);
 
-    semaphore_lock(&wq->empty_semaphore);
-    semaphore_unlock(&wq->empty_semaphore);
-    return 0;
+    if (!retval)
+        semaphore_unlock(&wq->empty_semaphore);
+    return retval;
 }
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2014-2015 Fabien Parent. All rights reserved.
+# Author: Fabien Parent <parent.f@gmail.com>
+#
+# Provided under the three clause BSD license found in the LICENSE file.
+#
+# Convert the output of the `trace dump` shell command into the Chrome trace
+# event format, which can be loaded in chrome://tracing or ui.perfetto.dev.
+#
+# usage: trace2json.py [console-log] > trace.json
+
+import json
+import sys
+
+TRACE_SWITCH = 0
+TRACE_WAIT = 1
+TRACE_WAKEUP = 2
+TRACE_IRQ_ENTER = 3
+TRACE_IRQ_EXIT = 4
+TRACE_SEM_BLOCK = 5
+TRACE_SEM_UNBLOCK = 6
+
+IRQ_TID = 1000
+
+
+def parse(lines):
+    freq = None
+    entries = []
+
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == 'TRACE':
+            if fields[1] == 'END':
+                break
+            freq = int(fields[1])
+            entries = []
+            continue
+        if freq is None or len(fields) != 4:
+            continue
+        entries.append((int(fields[0], 16), int(fields[1]), int(fields[2]),
+                        int(fields[3], 16)))
+
+    if freq is None:
+        sys.exit('error: no trace dump found')
+    return freq, entries
+
+
+def convert(freq, entries):
+    events = []
+    running = None
+    start = None
+    now = None
+
+    def instant(name, ts, tid, args):
+        events.append({'name': name, 'ph': 'i', 's': 't', 'ts': ts,
+                       'pid': 0, 'tid': tid, 'args': args})
+
+    for cycles, event, task, arg in entries:
+        # The timestamps are truncated to 32 bits. Entries can also be a bit
+        # out of order, since an IRQ can record an event between the slot
+        # reservation and the timestamp read of another, so the step to the
+        # previous entry is taken as the shortest one, forward or backward.
+        if now is None:
+            now = cycles
+        else:
+            step = (cycles - now) & 0xffffffff
+            if step >= 1 << 31:
+                step -= 1 << 32
+            now += step
+        ts = now * 1e6 / freq
+
+        if running is None:
+            running, start = task, ts
+
+        if event == TRACE_SWITCH:
+            events.append({'name': 'task %d' % running, 'ph': 'X',
+                           'ts': start, 'dur': ts - start,
+                           'pid': 0, 'tid': running})
+            running, start = arg, ts
+        elif event == TRACE_WAIT:
+            instant('wait', ts, arg, {'by': task})
+        elif event == TRACE_WAKEUP:
+            instant('wakeup', ts, arg, {'by': task})
+        elif event == TRACE_IRQ_ENTER:
+            events.append({'name': 'irq %d' % arg, 'ph': 'B', 'ts': ts,
+                           'pid': 0, 'tid': IRQ_TID})
+        elif event == TRACE_IRQ_EXIT:
+            events.append({'name': 'irq %d' % arg, 'ph': 'E', 'ts': ts,
+                           'pid': 0, 'tid': IRQ_TID})
+        elif event == TRACE_SEM_BLOCK:
+            instant('sem block', ts, task, {'sem': '0x%08x' % arg})
+        elif event == TRACE_SEM_UNBLOCK:
+            instant('sem unblock', ts, task, {'sem': '0x%08x' % arg})
+
+    tids = {e['tid'] for e in events}
+    for tid in sorted(tids):
+        name = 'irq' if tid == IRQ_TID else 'task %d' % tid
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 0,
+                       'tid': tid, 'args': {'name': name}})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    f = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    freq, entries = parse(f)
+    json.dump(convert(freq, entries), sys.stdout, indent=1)
+
+
+if __name__ == '__main__':
+    main()